@@ -0,0 +1,47 @@
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include "aliasTable.h"
+
+AliasTable::AliasTable(const std::vector<double>& weights)
+    : threshold_(weights.size()), alias_(weights.size()) {
+    assert(!weights.empty() && "AliasTable needs at least one weight");
+    double total = 0.0;
+    for (double w : weights) {
+        assert(w >= 0.0 && "AliasTable weights can't be negative");
+        total += w;
+    }
+    assert(total > 0.0 && "AliasTable needs a weight > 0");
+
+    // scale so the average column holds exactly 1.0, then pair every short column with a long one
+    size_t n = weights.size();
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small, large;
+    for (size_t i = 0; i < n; i++) {
+        scaled[i] = weights[i] * n / total;
+        (scaled[i] < 1.0 ? small : large).push_back(static_cast<uint32_t>(i));
+    }
+    while (!small.empty() && !large.empty()) {
+        uint32_t s = small.back();
+        small.pop_back();
+        uint32_t l = large.back();
+        threshold_[s] = static_cast<uint64_t>(std::ldexp(scaled[s], 32));
+        alias_[s] = l;
+        // l gives up what s was missing
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // what's left is 1.0 up to rounding, always keep the column
+    for (uint32_t i : large) {
+        threshold_[i] = 1ull << 32;
+        alias_[i] = i;
+    }
+    for (uint32_t i : small) {
+        threshold_[i] = 1ull << 32;
+        alias_[i] = i;
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef ALIASTABLE_H
+#define ALIASTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rng.h"
+
+/*
+    Walker alias table over a fixed list of weights (Vose's construction)
+    built once in O(n), then every sample is O(1) no matter how many outcomes there are,
+    unlike std::discrete_distribution which does a binary search per sample
+
+    a sample takes 64 random bits (one draw of a 64 bit engine, two of a 32 bit one),
+    the high 32 pick a column and the low 32 the side of it
+*/
+class AliasTable {
+    public:
+        AliasTable() {}
+
+        /*
+            weights don't need to sum to 1, at least one must be > 0 and none negative
+        */
+        explicit AliasTable(const std::vector<double>& weights);
+
+        size_t size() const {
+            return alias_.size();
+        }
+
+        /*
+            return an index with probability weights[index] / sum(weights)
+            URNG must give 32 or 64 random bits per call (ex. std::mt19937, Xoshiro256pp)
+        */
+        template <typename URNG>
+        size_t sample(URNG& gen) const {
+            return from_bits(rng_bits64(gen));
+        }
+
+        /*
+            write n samples to out, same draws as n calls to sample
+            the random bits are filled a block at a time (rng_fill) and then mapped in a second loop
+        */
+        template <typename URNG, typename OutputIt>
+        void sample_n(URNG& gen, size_t n, OutputIt out) const {
+            const size_t BLOCK = 256;
+            uint64_t bits[BLOCK];
+            for (size_t done = 0; done < n; done += BLOCK) {
+                size_t k = n - done < BLOCK ? n - done : BLOCK;
+                rng_fill(gen, bits, k);
+                for (size_t i = 0; i < k; i++, ++out) {
+                    *out = from_bits(bits[i]);
+                }
+            }
+        }
+
+    private:
+        size_t from_bits(uint64_t bits) const {
+            size_t column = static_cast<size_t>(((bits >> 32) * alias_.size()) >> 32);
+            uint32_t side_draw = static_cast<uint32_t>(bits);
+            return side_draw < threshold_[column] ? column : alias_[column];
+        }
+
+        // keep column with probability threshold_ / 2^32, otherwise take alias_
+        // threshold_ is 64 bit so a certain column (2^32) never takes its alias
+        std::vector<uint64_t> threshold_;
+        std::vector<uint32_t> alias_;
+};
+
+#endif // ALIASTABLE_H
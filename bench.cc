@@ -0,0 +1,499 @@
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+// custom header files
+#include "io.h"
+#include "linkedSequence.h"
+#include "mutationModel.h"
+#include "rng.h"
+#include "segmentRope.h"
+#include "threadPool.h"
+#include "utils.h"
+
+/*
+    Benchmark harness for every stage of the pipeline, run with make bench (BENCH_ARGS="..." to pass options)
+    synthetic references are generated, timed stage by stage and the results written out as JSON
+    so runs of different builds can be compared
+*/
+
+/*
+    command line options, anything not passed in keeps the default here
+*/
+struct BenchOptions {
+    // total bases of each synthetic reference
+    std::vector<size_t> sizes = {1000000, 10000000, 100000000};
+    // chromosomes per reference, sizes are split evenly
+    size_t chroms = 4;
+    // fraction of N bases, placed in runs like assembly gaps
+    double n_frac = 0.01;
+    // INDEL and SNP rates to time
+    std::vector<double> rates = {0.001, 0.01};
+    size_t threads = 1;
+    uint64_t seed = 1;
+    bool packed = false;
+    // directory the synthetic references and outputs go to
+    const char* dir = ".";
+    const char* out = "bench_results.json";
+    // keep the synthetic references and outputs after the run
+    bool keep = false;
+};
+
+/*
+    one timed stage, rate and mutations are 0 for stages that don't mutate
+*/
+struct BenchResult {
+    std::string stage;
+    size_t size;
+    double rate;
+    double seconds;
+    size_t bases;
+    size_t mutations;
+    long peak_rss_kb;
+};
+
+// peak resident set of the process so far
+static long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/*
+    run fn and return its wall time in seconds
+*/
+static double time_it(const std::function<void()>& fn) {
+    auto start = std::chrono::high_resolution_clock::now();
+    fn();
+    std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start;
+    return duration.count();
+}
+
+/*
+    parse "1M", "3G", "500K" or a plain number of bases
+*/
+static size_t parse_size(const char* text) {
+    char* end;
+    double value = strtod(text, &end);
+    switch (*end) {
+        case 'K': case 'k': value *= 1e3; break;
+        case 'M': case 'm': value *= 1e6; break;
+        case 'G': case 'g': value *= 1e9; break;
+    }
+    return static_cast<size_t>(value);
+}
+
+/*
+    split a comma separated list and parse each item with parse
+*/
+template <typename T>
+static std::vector<T> parse_list(const char* text, T (*parse)(const char*)) {
+    std::vector<T> out;
+    std::string all(text);
+    size_t begin = 0;
+    while (begin <= all.size()) {
+        size_t comma = all.find(',', begin);
+        if (comma == std::string::npos) {
+            comma = all.size();
+        }
+        out.push_back(parse(all.substr(begin, comma - begin).c_str()));
+        begin = comma + 1;
+    }
+    return out;
+}
+
+static double parse_double(const char* text) {
+    return strtod(text, nullptr);
+}
+
+void print_usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [--sizes 1M,10M,...] [--chroms N] [--n-frac F] [--rates R1,R2,...]\n"
+                    "       [--threads N] [--seed S] [--packed] [--dir D] [--out FILE] [--keep]\n", prog);
+}
+
+/*
+    parse argv into opts, return false on bad arguments
+*/
+bool parse_options(int argc, char* argv[], BenchOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            opts.sizes = parse_list<size_t>(argv[++i], parse_size);
+        } else if (strcmp(argv[i], "--chroms") == 0 && i + 1 < argc) {
+            opts.chroms = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--n-frac") == 0 && i + 1 < argc) {
+            opts.n_frac = strtod(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--rates") == 0 && i + 1 < argc) {
+            opts.rates = parse_list<double>(argv[++i], parse_double);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            opts.threads = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            opts.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--packed") == 0) {
+            opts.packed = true;
+        } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            opts.dir = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            opts.out = argv[++i];
+        } else if (strcmp(argv[i], "--keep") == 0) {
+            opts.keep = true;
+        } else {
+            return false;
+        }
+    }
+    return opts.chroms > 0 && opts.n_frac >= 0.0 && opts.n_frac < 1.0;
+}
+
+/*
+    write a random reference of size bases over chroms chromosomes to path
+    N bases come in runs of 100 to 10000, the rest is uniform ACGT
+*/
+static void write_synthetic_fasta(const char* path, size_t size, size_t chroms, double n_frac, uint64_t seed) {
+    std::mt19937_64 gen(seed);
+    std::uniform_int_distribution<size_t> n_run_len(100, 10000);
+    // expected gap between N runs so the N fraction comes out close to n_frac
+    double run_rate = n_frac <= 0.0 ? 0.0 : n_frac / 5050.0;
+    std::bernoulli_distribution run_starts(run_rate);
+    FastaWriter out(path, 60);
+    std::vector<char> buffer(1 << 16);
+    for (size_t c = 0; c < chroms; c++) {
+        size_t len = size / chroms + (c < size % chroms ? 1 : 0);
+        out.write_header("chr" + std::to_string(c + 1) + " synthetic");
+        size_t n_left = 0;
+        for (size_t done = 0; done < len; done += buffer.size()) {
+            size_t n = std::min(buffer.size(), len - done);
+            for (size_t i = 0; i < n; i++) {
+                if (n_left == 0 && run_rate > 0.0 && run_starts(gen)) {
+                    n_left = n_run_len(gen);
+                }
+                if (n_left > 0) {
+                    buffer[i] = 'N';
+                    n_left--;
+                } else {
+                    // 2 bits of a 64 bit draw per base would be faster, but generation isn't timed
+                    buffer[i] = "ACGT"[gen() & 3];
+                }
+            }
+            out.write_bases(buffer.data(), n);
+        }
+        out.end_record();
+    }
+}
+
+// number of records in a mutation record file, minus the 2 header lines
+static size_t count_records(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return 0;
+    }
+    size_t lines = 0;
+    char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        lines += std::count(buffer, buffer + n, '\n');
+    }
+    fclose(file);
+    return lines >= 2 ? lines - 2 : 0;
+}
+
+static size_t total_bases(const std::vector<Sequence*>& sequences) {
+    size_t bases = 0;
+    for (const Sequence* seq : sequences) {
+        bases += seq->size();
+    }
+    return bases;
+}
+
+/*
+    load path the way gen_mutation does, mmap + index then materialize every chromosome
+*/
+static std::vector<Sequence*> load_materialized(const char* path, bool packed, ThreadPool& workers) {
+    std::vector<Sequence*> sequences = load_fasta(path, packed);
+    parallel_for(workers, sequences.size(), [&](size_t i) { sequences[i]->materialize(); });
+    return sequences;
+}
+
+/*
+    time size alias sampled bases (AliasTable::sample_n) and size uniforms (rng_fill_uniform) with engine URNG
+    results are appended to results as rng_bases_<name> and rng_uniform_<name>
+*/
+template <typename URNG>
+static void bench_engine(const char* name, uint64_t seed, size_t size, std::vector<BenchResult>& results) {
+    std::seed_seq seq = {static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)};
+    URNG gen(seq);
+    AliasTable atcg({0.25, 0.25, 0.25, 0.25});
+    // a block at a time, so memory stays flat for any size
+    std::vector<uint8_t> bases(1 << 16);
+    std::vector<double> uniforms(1 << 16);
+    uint64_t checksum = 0;
+    double bases_seconds = time_it([&]() {
+        for (size_t done = 0; done < size; done += bases.size()) {
+            size_t n = std::min(bases.size(), size - done);
+            atcg.sample_n(gen, n, bases.begin());
+            checksum += bases[n - 1];
+        }
+    });
+    double uniform_seconds = time_it([&]() {
+        for (size_t done = 0; done < size; done += uniforms.size()) {
+            size_t n = std::min(uniforms.size(), size - done);
+            rng_fill_uniform(gen, uniforms.data(), n);
+            checksum += static_cast<uint64_t>(uniforms[n - 1] * 4);
+        }
+    });
+    // keep the loops from being optimized away
+    if (checksum == static_cast<uint64_t>(-1)) {
+        fprintf(stderr, "unlikely checksum\n");
+    }
+    results.push_back(BenchResult{std::string("rng_bases_") + name, size, 0.0, bases_seconds, size, 0, peak_rss_kb()});
+    results.push_back(BenchResult{std::string("rng_uniform_") + name, size, 0.0, uniform_seconds, size, 0, peak_rss_kb()});
+    fprintf(stderr, "%-16s size %zu: bases %.3f s, uniforms %.3f s\n", name, size, bases_seconds, uniform_seconds);
+}
+
+/*
+    time every stage on the reference at path, results are appended to results
+*/
+static void bench_reference(const BenchOptions& opts, const char* path, size_t size, ThreadPool& workers,
+                            std::vector<BenchResult>& results) {
+    auto add = [&](const std::string& stage, double rate, double seconds, size_t bases, size_t mutations) {
+        results.push_back(BenchResult{stage, size, rate, seconds, bases, mutations, peak_rss_kb()});
+        fprintf(stderr, "%-16s size %zu rate %g: %.3f s\n", stage.c_str(), size, rate, seconds);
+    };
+
+    /*----------parsing----------*/
+    std::vector<Sequence*> sequences;
+    double seconds = time_it([&]() { sequences = parse_data(path); });
+    add("parse_data", 0.0, seconds, total_bases(sequences), 0);
+    free_vector(sequences);
+
+    seconds = time_it([&]() { sequences = load_materialized(path, opts.packed, workers); });
+    add("load_fasta", 0.0, seconds, total_bases(sequences), 0);
+    free_vector(sequences);
+    // the index is reused from here on, same as repeated gen_mutation runs
+
+    /*----------LS operations----------*/
+    {
+        sequences = load_materialized(path, opts.packed, workers);
+        std::vector<LinkedSequence*> linkedseqs = init_vector_LinkedSequence(sequences);
+        size_t bases = total_bases(sequences);
+        // one split every 1 kb, chunks[c] gets every LS of chromosome c
+        // (not split_chunks, that gives each chunk its own SegmentPool)
+        std::vector<std::vector<LinkedSequence*>> chunks(linkedseqs.size());
+        seconds = time_it([&]() {
+            for (size_t c = 0; c < linkedseqs.size(); c++) {
+                LinkedSequence* ls = linkedseqs[c];
+                chunks[c].push_back(ls);
+                while (ls->size() > 1000) {
+                    ls = ls->split(ls->seq_pos(1000));
+                    chunks[c].push_back(ls);
+                }
+            }
+        });
+        size_t ops = 0;
+        for (const std::vector<LinkedSequence*>& chunk : chunks) {
+            ops += chunk.size() - 1;
+        }
+        add("ls_split", 0.0, seconds, bases, ops);
+
+        // one 10 base insertion and one 10 base deletion in every chunk, at the chunk start
+        std::seed_seq seq = {static_cast<uint32_t>(opts.seed), static_cast<uint32_t>(opts.seed >> 32)};
+        MutationRNG gen(seq);
+        AliasTable atcg({0.25, 0.25, 0.25, 0.25});
+        std::string ins_bases;
+        seconds = time_it([&]() {
+            for (std::vector<LinkedSequence*>& chunk : chunks) {
+                for (LinkedSequence* ls : chunk) {
+                    gen_n_nucleotides(atcg, 10, gen, ins_bases);
+                    ls->insert_bases(ins_bases.data(), ins_bases.size(), ls->front());
+                }
+            }
+        });
+        add("ls_insert", 0.0, seconds, bases, ops + chunks.size());
+        seconds = time_it([&]() {
+            for (std::vector<LinkedSequence*>& chunk : chunks) {
+                for (LinkedSequence* ls : chunk) {
+                    // after the insert ls is an empty LS in front of the new one
+                    LinkedSequence* target = ls->get_next()->get_next();
+                    if (target != nullptr && target->size() > 10) {
+                        target->delete_section(target->front(), 10);
+                    }
+                }
+            }
+        });
+        add("ls_delete", 0.0, seconds, bases, ops + chunks.size());
+
+        // a 4 kb range from every chunk start, crossing several LS, copied out or only walked
+        const size_t RANGE = 4096;
+        std::vector<char> range(RANGE);
+        size_t copied = 0;
+        seconds = time_it([&]() {
+            for (const std::vector<LinkedSequence*>& chunk : chunks) {
+                for (const LinkedSequence* ls : chunk) {
+                    copied += ls->copy_range(0, RANGE, range.data());
+                }
+            }
+        });
+        add("ls_copy_range", 0.0, seconds, copied, ops + chunks.size());
+        size_t spanned = 0;
+        seconds = time_it([&]() {
+            for (const std::vector<LinkedSequence*>& chunk : chunks) {
+                for (const LinkedSequence* ls : chunk) {
+                    SpanIterator spans(ls, 0, RANGE);
+                    BaseSpan span;
+                    while (spans.next(span)) {
+                        spanned += span.len;
+                    }
+                }
+            }
+        });
+        add("ls_spans", 0.0, seconds, spanned, ops + chunks.size());
+
+        // the same kind of edits at random positions through the rope
+        SegmentRope rope(linkedseqs[0]);
+        std::uniform_int_distribution<size_t> gen_pos(0, rope.size() - 1);
+        size_t rope_ops = std::min<size_t>(100000, rope.size() / 100 + 1);
+        seconds = time_it([&]() {
+            for (size_t i = 0; i < rope_ops; i++) {
+                size_t pos = gen_pos(gen) % rope.size();
+                if (i % 2 == 0) {
+                    rope.insert_seq(gen_inserted_seq(atcg, 10, gen, opts.packed), pos);
+                } else {
+                    rope.delete_section(pos, 10);
+                }
+            }
+        });
+        add("rope_edit", 0.0, seconds, rope.size(), rope_ops);
+
+        free_linkedseqs(linkedseqs);
+        free_vector(sequences);
+    }
+
+    /*----------mutation passes and output, once per rate----------*/
+    // the built in model, only the rate changes
+    MutationModel model = default_model();
+    for (double rate : opts.rates) {
+        sequences = load_materialized(path, opts.packed, workers);
+        std::vector<LinkedSequence*> linkedseqs = init_vector_LinkedSequence(sequences);
+        size_t bases = total_bases(sequences);
+
+        seconds = time_it([&]() {
+            RecordSink records(path, "bench_record_indel");
+            gen_INDEL(linkedseqs, records, model.ins_prob, model.del_prob, model.ins_base_prob, rate, opts.seed, workers);
+        });
+        add("gen_INDEL", rate, seconds, bases, count_records("bench_record_indel"));
+
+        seconds = time_it([&]() {
+            RecordSink records(path, "bench_record_snp");
+            gen_SNP(sequences, records, model.snp_prob, rate, opts.seed, workers);
+        });
+        add("gen_SNP", rate, seconds, bases, count_records("bench_record_snp"));
+
+        size_t written = 0;
+        seconds = time_it([&]() {
+            for (LinkedSequence* ls : linkedseqs) {
+                written += ls->to_string_all().size();
+            }
+        });
+        add("to_string_all", rate, seconds, written, 0);
+
+        seconds = time_it([&]() { write_mutated_ref(path, linkedseqs); });
+        add("write_mutated_ref", rate, seconds, written, 0);
+
+        free_linkedseqs(linkedseqs);
+        free_vector(sequences);
+
+        // both passes above in one walk, same rates
+        sequences = load_materialized(path, opts.packed, workers);
+        linkedseqs = init_vector_LinkedSequence(sequences);
+        seconds = time_it([&]() {
+            RecordSink records(path, "bench_record_snp_indel");
+            gen_SNP_INDEL(linkedseqs, records, model.ins_prob, model.del_prob, model.ins_base_prob, rate,
+                          model.snp_prob, rate, opts.seed, workers);
+        });
+        add("gen_SNP_INDEL", rate, seconds, bases, count_records("bench_record_snp_indel"));
+        free_linkedseqs(linkedseqs);
+        free_vector(sequences);
+        if (!opts.keep) {
+            remove(mutated_filename(path).c_str());
+            remove("bench_record_indel");
+            remove("bench_record_snp");
+            remove("bench_record_snp_indel");
+        }
+    }
+}
+
+/*
+    write results as JSON, one object per timed stage
+*/
+static bool write_json(const BenchOptions& opts, const std::vector<BenchResult>& results) {
+    FILE* file = fopen(opts.out, "w");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open %s\n", opts.out);
+        return false;
+    }
+    fprintf(file, "{\n  \"compiler\": \"%s\",\n", __VERSION__);
+    fprintf(file, "  \"config\": {\"chroms\": %zu, \"n_frac\": %g, \"threads\": %zu, \"seed\": %llu, \"packed\": %s},\n",
+            opts.chroms, opts.n_frac, opts.threads, static_cast<unsigned long long>(opts.seed),
+            opts.packed ? "true" : "false");
+    fprintf(file, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        double seconds = r.seconds > 0.0 ? r.seconds : 1e-9;
+        fprintf(file, "    {\"stage\": \"%s\", \"size\": %zu, \"rate\": %g, \"seconds\": %.6f, "
+                      "\"bases_per_s\": %.0f, \"mutations\": %zu, \"mutations_per_s\": %.0f, \"peak_rss_kb\": %ld}%s\n",
+                r.stage.c_str(), r.size, r.rate, r.seconds, r.bases / seconds, r.mutations, r.mutations / seconds,
+                r.peak_rss_kb, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions opts;
+    if (!parse_options(argc, argv, opts)) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    // the output path is relative to where bench was started
+    char cwd[4096];
+    std::string out_path = opts.out;
+    if (opts.out[0] != '/' && getcwd(cwd, sizeof(cwd)) != nullptr) {
+        out_path = std::string(cwd) + "/" + opts.out;
+    }
+    opts.out = out_path.c_str();
+    if (chdir(opts.dir) != 0) {
+        fprintf(stderr, "Failed to enter %s\n", opts.dir);
+        return EXIT_FAILURE;
+    }
+
+    ThreadPool workers(opts.threads);
+    std::vector<BenchResult> results;
+    for (size_t size : opts.sizes) {
+        std::string path = "bench_" + std::to_string(size) + ".fa";
+        fprintf(stderr, "Generating %s\n", path.c_str());
+        write_synthetic_fasta(path.c_str(), size, opts.chroms, opts.n_frac, opts.seed);
+        // both engines, whichever one MutationRNG is
+        bench_engine<std::mt19937>("mt19937", opts.seed, size, results);
+        bench_engine<Xoshiro256pp>("xoshiro256pp", opts.seed, size, results);
+        bench_reference(opts, path.c_str(), size, workers, results);
+        if (!opts.keep) {
+            remove(path.c_str());
+            remove((path + ".fai").c_str());
+        }
+    }
+    if (!write_json(opts, results)) {
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "Results written to %s\n", opts.out);
+    return EXIT_SUCCESS;
+}
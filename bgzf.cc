@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef NO_ZLIB
+#include <zlib.h>
+#endif
+
+#include "bgzf.h"
+#include "stats.h"
+
+// largest BGZF block, header + deflated data + footer, BSIZE is 16 bits
+static const size_t BGZF_MAX_BLOCK = 1 << 16;
+static const size_t BGZF_HEADER_SIZE = 18;
+static const size_t BGZF_FOOTER_SIZE = 8;
+// gzip header with the "BC" extra field, BSIZE (block size - 1) goes in the last 2 bytes
+static const unsigned char BGZF_HEADER[BGZF_HEADER_SIZE] = {
+    0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0, 0
+};
+// empty block every BGZF file ends with, tells readers the file wasn't truncated
+static const unsigned char BGZF_EOF[28] = {
+    0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0x1b, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+static void put_le(unsigned char* dst, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        dst[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+
+/*
+    deflate data into one complete BGZF block in out
+    stored (level 0) if the deflated data doesn't fit, which only random data can cause
+*/
+static void deflate_block(const std::string& data, std::string& out) {
+#ifndef NO_ZLIB
+    out.resize(BGZF_MAX_BLOCK);
+    unsigned char* dst = reinterpret_cast<unsigned char*>(&out[0]);
+    memcpy(dst, BGZF_HEADER, BGZF_HEADER_SIZE);
+    size_t deflated = 0;
+    for (int level : {Z_DEFAULT_COMPRESSION, Z_NO_COMPRESSION}) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        // raw deflate, the gzip header and footer are written by hand
+        deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+        zs.avail_in = static_cast<uInt>(data.size());
+        zs.next_out = dst + BGZF_HEADER_SIZE;
+        zs.avail_out = static_cast<uInt>(BGZF_MAX_BLOCK - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE);
+        int ret = deflate(&zs, Z_FINISH);
+        deflated = zs.total_out;
+        deflateEnd(&zs);
+        if (ret == Z_STREAM_END) {
+            break;
+        }
+    }
+    size_t total = BGZF_HEADER_SIZE + deflated + BGZF_FOOTER_SIZE;
+    put_le(dst + 16, total - 1, 2);
+    uLong crc = crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(data.data()),
+                      static_cast<uInt>(data.size()));
+    put_le(dst + BGZF_HEADER_SIZE + deflated, crc, 4);
+    put_le(dst + BGZF_HEADER_SIZE + deflated + 4, data.size(), 4);
+    out.resize(total);
+#else
+    (void)data;
+    out.clear();
+#endif
+}
+
+bool bgzf_available() {
+#ifndef NO_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+BgzfWriter::BgzfWriter(const char* path, size_t threads)
+    : file_(nullptr), failed_(false), pool_(threads), batch_blocks_(4 * pool_.size()),
+      filling_(batch_blocks_), compressing_(batch_blocks_), filled_(0), compressing_count_(0),
+      compressed_offset_(0), uncompressed_offset_(0) {
+    if (!bgzf_available()) {
+        std::cerr << "Built without zlib (make ZLIB=0), unable to write " << path << std::endl;
+        return;
+    }
+    file_ = fopen(path, "wb");
+    if (file_ == nullptr) {
+        std::cerr << "Unable to open BGZF output file " << path << std::endl;
+        return;
+    }
+}
+
+BgzfWriter::~BgzfWriter() {
+    close();
+}
+
+void BgzfWriter::write(const char* data, size_t n) {
+    if (file_ == nullptr) {
+        return;
+    }
+    while (n > 0) {
+        if (filled_ == 0 || filling_[filled_ - 1].data.size() == BGZF_BLOCK_SIZE) {
+            if (filled_ == batch_blocks_) {
+                start_batch();
+            }
+            filling_[filled_].data.clear();
+            filling_[filled_].data.reserve(BGZF_BLOCK_SIZE);
+            filled_++;
+        }
+        std::string& block = filling_[filled_ - 1].data;
+        size_t chunk = std::min(n, BGZF_BLOCK_SIZE - block.size());
+        block.append(data, chunk);
+        data += chunk;
+        n -= chunk;
+    }
+}
+
+void BgzfWriter::start_batch() {
+    // the previous batch has to be on disk before its blocks are refilled
+    pool_.wait();
+    write_batch();
+    std::swap(filling_, compressing_);
+    compressing_count_ = filled_;
+    filled_ = 0;
+    for (size_t i = 0; i < compressing_count_; i++) {
+        Block* block = &compressing_[i];
+        pool_.submit([block]() { deflate_block(block->data, block->deflated); });
+    }
+}
+
+void BgzfWriter::write_batch() {
+    for (size_t i = 0; i < compressing_count_; i++) {
+        const Block& block = compressing_[i];
+        size_t written;
+        STAT_TIMED(STAT_WRITE_NS, written = fwrite(block.deflated.data(), 1, block.deflated.size(), file_));
+        STAT_ADD(STAT_BYTES_WRITTEN, written);
+        failed_ = failed_ || written != block.deflated.size();
+        compressed_offset_ += block.deflated.size();
+        uncompressed_offset_ += block.data.size();
+        index_.push_back(std::make_pair(compressed_offset_, uncompressed_offset_));
+    }
+    compressing_count_ = 0;
+}
+
+bool BgzfWriter::close() {
+    if (file_ == nullptr) {
+        return !failed_;
+    }
+    start_batch();
+    pool_.wait();
+    write_batch();
+    failed_ = failed_ || fwrite(BGZF_EOF, 1, sizeof(BGZF_EOF), file_) != sizeof(BGZF_EOF);
+    failed_ = fclose(file_) != 0 || failed_;
+    file_ = nullptr;
+    if (failed_) {
+        std::cerr << "Unable to write BGZF output file" << std::endl;
+    }
+    return !failed_;
+}
+
+bool BgzfWriter::write_index(const char* gzi_path) const {
+    FILE* gzi = fopen(gzi_path, "wb");
+    if (gzi == nullptr) {
+        std::cerr << "Unable to write BGZF index " << gzi_path << std::endl;
+        return false;
+    }
+    // index_ holds the end of every block, the last one is the end of the data and starts no block
+    size_t count = index_.empty() ? 0 : index_.size() - 1;
+    std::vector<unsigned char> bytes(8 * (1 + 2 * count));
+    put_le(bytes.data(), count, 8);
+    for (size_t i = 0; i < count; i++) {
+        put_le(bytes.data() + 8 * (1 + 2 * i), index_[i].first, 8);
+        put_le(bytes.data() + 8 * (2 + 2 * i), index_[i].second, 8);
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), gzi) == bytes.size();
+    ok = fclose(gzi) == 0 && ok;
+    return ok;
+}
+
+bool bgzf_compress_file(const char* path, size_t threads) {
+    FILE* in = fopen(path, "rb");
+    if (in == nullptr) {
+        std::cerr << "Unable to open " << path << std::endl;
+        return false;
+    }
+    bool ok;
+    {
+        BgzfWriter out((std::string(path) + ".gz").c_str(), threads);
+        std::vector<char> buffer(1 << 20);
+        size_t n;
+        while ((n = fread(buffer.data(), 1, buffer.size(), in)) > 0) {
+            out.write(buffer.data(), n);
+        }
+        ok = !ferror(in) && out.is_open() && out.close();
+    }
+    fclose(in);
+    if (ok) {
+        remove(path);
+    }
+    return ok;
+}
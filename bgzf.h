@@ -0,0 +1,86 @@
+#ifndef BGZF_H
+#define BGZF_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "threadPool.h"
+
+/*
+    BGZF (blocked gzip) output, the format of bgzip and htslib: a series of gzip members holding at most
+    BGZF_BLOCK_SIZE bytes each, so zcat reads it like any .gz and samtools can seek in it with a .gzi
+
+    input is cut into blocks and gathered in batches, a full batch is deflated on a private pool while the
+    next one fills, then written in order, so writing never waits on compression of the data just handed in
+    build with make ZLIB=0 (-DNO_ZLIB) to drop the zlib dependency, every BgzfWriter then fails to open
+*/
+class BgzfWriter {
+    public:
+        // uncompressed bytes per block, same as htslib so a compressed block always fits in 64 KB
+        static constexpr size_t BGZF_BLOCK_SIZE = 0xff00;
+
+        /*
+            create path, threads deflate blocks, 1 compresses on the calling thread
+        */
+        BgzfWriter(const char* path, size_t threads);
+        // close() if not done yet
+        ~BgzfWriter();
+
+        BgzfWriter(const BgzfWriter&) = delete;
+        BgzfWriter& operator=(const BgzfWriter&) = delete;
+
+        bool is_open() const {
+            return file_ != nullptr;
+        }
+
+        void write(const char* data, size_t n);
+
+        /*
+            compress and write everything left, add the EOF block and close the file
+            return false if any write failed
+        */
+        bool close();
+
+        /*
+            write the .gzi index of the blocks written so far (htslib layout: count, then the
+            (compressed, uncompressed) offset pair of every block start but the first, little endian 64 bit)
+        */
+        bool write_index(const char* gzi_path) const;
+
+    private:
+        struct Block {
+            std::string data;
+            std::string deflated;
+        };
+
+        FILE* file_;
+        bool failed_;
+        ThreadPool pool_;
+        size_t batch_blocks_;
+        // batch being filled by write, and batch deflating on pool_
+        std::vector<Block> filling_;
+        std::vector<Block> compressing_;
+        size_t filled_;
+        size_t compressing_count_;
+        uint64_t compressed_offset_;
+        uint64_t uncompressed_offset_;
+        std::vector<std::pair<uint64_t, uint64_t>> index_;
+
+        void start_batch();
+        void write_batch();
+};
+
+/*
+    false if built without zlib (make ZLIB=0), BGZF output is unavailable then
+*/
+bool bgzf_available();
+
+/*
+    compress path into path + ".gz" and remove path, like bgzip, return false on error
+*/
+bool bgzf_compress_file(const char* path, size_t threads);
+
+#endif // BGZF_H
@@ -1,16 +1,29 @@
+#include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <random>
 #include <string>
+#include <thread>
 #include <sstream>
 #include <vector>
 
 // custom header files
+#include "bgzf.h"
 #include "io.h"
 #include "linkedSequence.h"
+#include "liftover.h"
+#include "mutationModel.h"
+#include "readSimulator.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "threadPool.h"
 #include "utils.h"
 
 void output_performance(std::chrono::time_point<std::chrono::high_resolution_clock>& start) {
@@ -19,82 +32,713 @@ void output_performance(std::chrono::time_point<std::chrono::high_resolution_clo
     std::cout << "Program elapsed time: " << duration.count() << " ms" << std::endl;
 }
 
-// code for running gen mutation with LinekedSequence
-int gen_mutation(int argc, char* argv[], std::chrono::time_point<std::chrono::high_resolution_clock>& start) {
+/*
+    mutation passes in the order they run, a snapshot records how many are done
+*/
+enum MutationPass { PASS_SV, PASS_CNV, PASS_INDEL, PASS_SNP, PASS_COUNT };
 
-    /*---------------command line parsing----------*/
+static const char* const PASS_NAMES[PASS_COUNT] = {"sv", "cnv", "indel", "snp"};
 
-    // turn this to three if you take in a mutation model file 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <fasta_file>\n", argv[0]);
-        return EXIT_FAILURE;
+/*
+    command line options, anything not passed in keeps the default here
+*/
+struct RunOptions {
+    const char* fasta = nullptr;
+    // bases per line in the mutated FA, 0 for one line per record
+    size_t line_width = 60;
+    // "->" between segments in the mutated FA
+    bool debug = false;
+    // worker threads for the mutation passes
+    size_t threads = 1;
+    // store bases 2 bit packed instead of one char per base
+    bool packed = false;
+    // RNG seed, drawn from std::random_device unless given
+    bool has_seed = false;
+    uint64_t seed = 0;
+    // samples x ploidy haplotypes are made from the one reference, 1 x 1 mutates it in place
+    size_t samples = 1;
+    size_t ploidy = 1;
+    // fraction of every mutation rate applied once to an ancestor shared by all haplotypes
+    double shared = 0.0;
+    // JSON run statistics written at the end
+    const char* stats = "run_stats.json";
+    // seconds between progress lines on stderr, 0 for none
+    double progress = 0.0;
+    // mutation model file, anything it leaves out keeps the built in model
+    const char* model = nullptr;
+    // read, mutate, write and free one FA record at a time
+    bool stream = false;
+    // write a chain file next to the mutated FA and a MUT_POS column in the record
+    bool liftover = false;
+    // mutated FA (plus .fai/.gzi) and mutation record written BGZF compressed, as <name>.gz
+    bool bgzf = false;
+    // INDEL and SNP in one walk over the LS chains (gen_SNP_INDEL) instead of one pass each
+    bool fused = false;
+    // paired end FASTQ reads of every mutated genome, reads.coverage 0 for none
+    ReadModel reads;
+    // independent genomes made side by side from the one parsed reference, 0 for a normal run
+    size_t replicates = 0;
+    // passes run are [first pass, stop_after], first pass is PASS_SV unless resumed from a snapshot
+    int stop_after = PASS_SNP;
+    // snapshot of the LS chains written once the passes are done
+    const char* save_snapshot = nullptr;
+    // snapshot to resume from instead of parsing the FA
+    const char* load_snapshot = nullptr;
+};
+
+void print_usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [--line-width N] [--debug] [--threads N] [--seed S] [--packed]\n"
+                    "       [--samples N] [--ploidy P] [--shared F] [--stats FILE] [--progress SECONDS]\n"
+                    "       [--model FILE] [--stream] [--liftover] [--bgzf] [--fused] [--replicates N]\n"
+                    "       [--reads COVERAGE] [--read-length N] [--insert-size MEAN] [--insert-sd SD]\n"
+                    "       [--read-error FIRST[,LAST]] [--stop-after sv|cnv|indel|snp]\n"
+                    "       [--save-snapshot FILE] [--load-snapshot FILE] <fasta_file>\n",
+            prog);
+}
+
+/*
+    parse argv into opts, return false on bad or missing arguments
+*/
+bool parse_options(int argc, char* argv[], RunOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--line-width") == 0 && i + 1 < argc) {
+            opts.line_width = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--debug") == 0) {
+            opts.debug = true;
+        } else if (strcmp(argv[i], "--packed") == 0) {
+            opts.packed = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            opts.threads = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            opts.seed = strtoull(argv[++i], nullptr, 10);
+            opts.has_seed = true;
+        } else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            opts.samples = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--ploidy") == 0 && i + 1 < argc) {
+            opts.ploidy = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--shared") == 0 && i + 1 < argc) {
+            opts.shared = strtod(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            opts.stats = argv[++i];
+        } else if (strcmp(argv[i], "--progress") == 0 && i + 1 < argc) {
+            opts.progress = strtod(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            opts.stream = true;
+        } else if (strcmp(argv[i], "--liftover") == 0) {
+            opts.liftover = true;
+        } else if (strcmp(argv[i], "--bgzf") == 0) {
+            opts.bgzf = true;
+        } else if (strcmp(argv[i], "--fused") == 0) {
+            opts.fused = true;
+        } else if (strcmp(argv[i], "--replicates") == 0 && i + 1 < argc) {
+            opts.replicates = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--reads") == 0 && i + 1 < argc) {
+            opts.reads.coverage = strtod(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--read-length") == 0 && i + 1 < argc) {
+            opts.reads.read_length = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--insert-size") == 0 && i + 1 < argc) {
+            opts.reads.insert_mean = strtod(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--insert-sd") == 0 && i + 1 < argc) {
+            opts.reads.insert_sd = strtod(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--read-error") == 0 && i + 1 < argc) {
+            // FIRST,LAST or one rate for every position
+            char* end;
+            opts.reads.error_first = strtod(argv[++i], &end);
+            opts.reads.error_last = *end == ',' ? strtod(end + 1, nullptr) : opts.reads.error_first;
+        } else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+            opts.model = argv[++i];
+        } else if (strcmp(argv[i], "--stop-after") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            opts.stop_after = -1;
+            for (int pass = 0; pass < PASS_COUNT; pass++) {
+                if (strcmp(name, PASS_NAMES[pass]) == 0) {
+                    opts.stop_after = pass;
+                }
+            }
+            if (opts.stop_after < 0) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) {
+            opts.save_snapshot = argv[++i];
+        } else if (strcmp(argv[i], "--load-snapshot") == 0 && i + 1 < argc) {
+            opts.load_snapshot = argv[++i];
+        } else if (argv[i][0] == '-' || opts.fasta != nullptr) {
+            return false;
+        } else {
+            opts.fasta = argv[i];
+        }
     }
-    /*---------------input files parsing----------*/
-    // parse input fasta
-    std::cout << "Start Parsing input fasta" << std::endl;
-    std::vector<Sequence*> sequences = parse_data(argv[1]);
-    std::cout << "Complete Parsing input fasta" << std::endl;
-    output_performance(start);
+    // streaming writes one genome, haplotypes need every chromosome of the ancestor at once
+    bool one_genome = opts.samples * opts.ploidy == 1 && opts.shared == 0.0;
+    const ReadModel& reads = opts.reads;
+    bool reads_ok = reads.coverage >= 0.0 && reads.read_length > 0 && reads.insert_sd >= 0.0 &&
+                    reads.error_first >= 0.0 && reads.error_first <= 1.0 &&
+                    reads.error_last >= 0.0 && reads.error_last <= 1.0;
+    // a snapshot holds one genome with every chromosome at once, stopping early is meant for it
+    bool snapshot = opts.save_snapshot != nullptr || opts.load_snapshot != nullptr || opts.stop_after != PASS_SNP;
+    bool snapshot_ok = !snapshot || (one_genome && !opts.stream);
+    // replicates are one genome each, made at once from the parsed reference
+    bool replicates_ok = opts.replicates == 0 || (one_genome && !opts.stream && !snapshot);
+    // the FA name comes from the snapshot if not given
+    return (opts.fasta != nullptr || opts.load_snapshot != nullptr) && opts.samples > 0 && opts.ploidy > 0 &&
+           opts.shared >= 0.0 && opts.shared <= 1.0 && (one_genome || !opts.stream) && reads_ok && snapshot_ok &&
+           replicates_ok;
+}
 
-    std::vector<LinkedSequence*> linkedseqs = init_vector_LinkedSequence(sequences);
+/*
+    --bgzf: threads compressing the mutated FA, 0 writes plain text
+*/
+static size_t fasta_bgzf_threads(const RunOptions& opts) {
+    return opts.bgzf ? std::max<size_t>(opts.threads, 1) : 0;
+}
 
-    /*---------------Add mutations----------*/
-    // mutation setup
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    // set up mutation record
-    std::ofstream mut_record = init_mutation_record(argv[1]);
-
-    // set avg mutation rate, this determines the probability of each mutation
-    double avg_mut_rate_SV = 0.01;
-    double avg_mut_rate_CNV = 0.01;
-    double avg_mut_rate_INDEL = 0.01;
-    double avg_mut_rate_SNP = 0.02;
-    
+/*
+    --bgzf: threads compressing a record while it is written, 0 writes it as text
+    --stream joins and --liftover rewrites the record once it is written, those compress it in finish_record
+*/
+static size_t record_bgzf_threads(const RunOptions& opts) {
+    return opts.stream || opts.liftover ? 0 : fasta_bgzf_threads(opts);
+}
+
+// record file of tag, "mutation_record" or "mutation_record_<tag>", ".gz" added if compressed as it is written
+static std::string record_path(const RunOptions& opts, const std::string& tag) {
+    std::string path = tag.empty() ? "mutation_record" : "mutation_record_" + tag;
+    return record_bgzf_threads(opts) > 0 ? path + ".gz" : path;
+}
+
+/*
+    call once the record at path is complete, --bgzf compresses it into path.gz now if it was written as text
+*/
+static void finish_record(const RunOptions& opts, const std::string& path) {
+    if (opts.bgzf && record_bgzf_threads(opts) == 0) {
+        StatTimer timer("compress");
+        bgzf_compress_file(path.c_str(), fasta_bgzf_threads(opts));
+    }
+}
+
+/*
+    --reads: FASTQ name of tag without the "_R1.fq", the mutated FA name without its extension
+    ex. mut_ref for ref.fa, or mut_ref_S1 with tag "S1"
+*/
+static std::string reads_prefix(const char* fasta, const std::string& tag) {
+    std::string name = mutated_filename(fasta, tag);
+    size_t dot_pos = name.rfind('.');
+    return dot_pos == std::string::npos ? name : name.substr(0, dot_pos);
+}
+
+/*
+    --reads: write the reads of every chain, chromosome c of the genome is chains[c]
+    seed picks the RNG streams (the run seed, or the haplotype seed), snps (if given) are patched in
+    verbose = false prints no progress lines
+*/
+static void simulate_reads(const RunOptions& opts, const std::vector<LinkedSequence*>& chains, const std::string& tag,
+                           uint64_t seed, ThreadPool& workers, const SnpOverlay* snps,
+                           std::chrono::time_point<std::chrono::high_resolution_clock>& start, bool verbose = true) {
+    if (verbose) {
+        std::cout << "Start simulating reads" << std::endl;
+    }
+    size_t pairs;
+    {
+        StatTimer timer("reads");
+        ReadSimulator reads(opts.reads, reads_prefix(opts.fasta, tag), seed, fasta_bgzf_threads(opts));
+        for (size_t c = 0; c < chains.size(); c++) {
+            reads.simulate(chains[c], c, workers, snps);
+        }
+        pairs = reads.pairs();
+    }
+    if (verbose) {
+        std::cout << "Complete simulating reads: " << pairs << " pairs" << std::endl;
+        output_performance(start);
+    }
+}
+
+/*
+    run the passes first_pass to end_pass - 1 on linkedseqs with each rate of model multiplied by scale
+    SNP go into snps if given, otherwise straight into sequences
+    every pass draws from its own RNG streams, so a run split at a pass boundary matches one straight run
+    fused runs INDEL and SNP as one walk (gen_SNP_INDEL) when both are in the range
+    verbose = false prints no progress lines, for genomes mutated side by side
+*/
+void apply_mutations(const MutationModel& model, double scale,
+                     std::vector<Sequence*>& sequences,
+                     std::vector<LinkedSequence*>& linkedseqs,
+                     RecordSink& mut_record,
+                     uint64_t seed,
+                     ThreadPool& workers,
+                     SnpOverlay* snps,
+                     std::chrono::time_point<std::chrono::high_resolution_clock>& start,
+                     int first_pass = PASS_SV, int end_pass = PASS_COUNT, bool fused = false,
+                     bool verbose = true) {
+    // progress line on stdout, timed ones add the elapsed time
+    auto report = [&](const char* line, bool timed) {
+        if (verbose) {
+            std::cout << line << std::endl;
+            if (timed) {
+                output_performance(start);
+            }
+        }
+    };
     // start from large scale mutation to smaller
     // SV -> CNV -> indel -> SNP
     /*----------SV----------*/
-    // TODO: Not sure how to do it yet, but involving breaking up larger LS into pieces via split and moving the next_
-    //       pointer to manipulate LS between chromozones 
+    if (first_pass <= PASS_SV && PASS_SV < end_pass) {
+        SVModel sv_model = model.sv;
+        sv_model.rate *= scale;
+        report("Start simulate SV", false);
+        {
+            StatTimer timer("SV");
+            gen_SV(linkedseqs, mut_record, sv_model, seed);
+        }
+        report("Complete simulate SV", true);
+    }
+
     /*----------CNV----------*/
-    // TODO: idea is to use LS.split to break off LS we want, and use shallow copy to make copies of this segment
-    // then perform similar action to insert_seq, but instead of inserting a newly created LS from sequence,
-    // insert a copy of a LS
+    if (first_pass <= PASS_CNV && PASS_CNV < end_pass) {
+        CNVModel cnv_model = model.cnv;
+        cnv_model.rate *= scale;
+        // call cnv mutation
+        report("Start simulate CNV", false);
+        {
+            StatTimer timer("CNV");
+            gen_CNV(linkedseqs, mut_record, cnv_model, seed, workers);
+        }
+        report("Complete simulate CNV", true);
+    }
+
+    /*----------INDEL + SNP----------*/
+    fused = fused && first_pass <= PASS_INDEL && PASS_SNP < end_pass;
+    if (fused) {
+        report("Start simulate INDEL + SNP", false);
+        {
+            StatTimer timer("SNP_INDEL");
+            gen_SNP_INDEL(linkedseqs, mut_record, model.ins_prob, model.del_prob, model.ins_base_prob,
+                          model.indel_rate * scale, model.snp_prob, model.snp_rate * scale, seed, workers,
+                          SampleMode::GEOMETRIC, DEFAULT_CHUNK_BASES, snps);
+        }
+        report("Complete simulate INDEL + SNP", true);
+    }
 
     /*----------INDEL----------*/
-    // indel probability, 0 index must be 0.0 (no point ins/del 0 base pairs)
-    // does NOT need to sum to 1
-    std::vector<double> ins_prob = {0.0, 20,19,18,17,16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1};
-    std::vector<double> del_prob = {0.0, 20,19,18,17,16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1};
-    // call indel mutation
-    std::cout << "Start simulate INDEL" << std::endl;
-    gen_INDEL(linkedseqs, mut_record, ins_prob, del_prob, avg_mut_rate_INDEL, gen);
-    std::cout << "Complete simulate INDEL" << std::endl;
-    output_performance(start);
+    if (!fused && first_pass <= PASS_INDEL && PASS_INDEL < end_pass) {
+        std::vector<double> ins_prob = model.ins_prob;
+        std::vector<double> del_prob = model.del_prob;
+        std::vector<double> ins_base_prob = model.ins_base_prob;
+        // call indel mutation
+        report("Start simulate INDEL", false);
+        {
+            StatTimer timer("INDEL");
+            gen_INDEL(linkedseqs, mut_record, ins_prob, del_prob, ins_base_prob, model.indel_rate * scale, seed,
+                      workers);
+        }
+        report("Complete simulate INDEL", true);
+    }
 
     /*----------SNP----------*/
-    // snp probabilities
-    std::vector<std::vector<double>> snp_prob(4, std::vector<double>(4, 1.0));
-    for (size_t i = 0; i < 4; i++) {
-        snp_prob[i][i] = 0.0;  // can't mut to itself
-    }
-    // call snp mutation
-    std::cout << "Start simulate SNP" << std::endl;
-    gen_SNP(sequences, mut_record, snp_prob, avg_mut_rate_SNP, gen);
-    std::cout << "Complete simulate SNP" << std::endl;
-    output_performance(start);
+    if (!fused && first_pass <= PASS_SNP && PASS_SNP < end_pass) {
+        std::vector<std::vector<double>> snp_prob = model.snp_prob;
+        // call snp mutation
+        report("Start simulate SNP", false);
+        {
+            StatTimer timer("SNP");
+            gen_SNP(sequences, mut_record, snp_prob, model.snp_rate * scale, seed, workers,
+                    SampleMode::GEOMETRIC, DEFAULT_CHUNK_BASES, snps);
+        }
+        report("Complete simulate SNP", true);
+    }
+}
 
-    /*---------------Output mutated reference----------*/
-    std::cout << "Start writing to output" << std::endl;
-    write_mutated_ref(argv[1], linkedseqs);
-    std::cout << "Complete writing to output" << std::endl;
-    output_performance(start);
+/*
+    append the records of src_path to dst_path, skipping the header lines, then remove src_path
+*/
+static void join_record_file(const char* dst_path, const char* src_path) {
+    {
+        std::ifstream src(src_path, std::ios::binary);
+        std::ofstream dst(dst_path, std::ios::binary | std::ios::app);
+        std::string header;
+        while (src.peek() == '#' && std::getline(src, header)) {}
+        if (src.peek() != std::ifstream::traits_type::eof()) {
+            dst << src.rdbuf();
+        }
+    }
+    remove(src_path);
+}
+
+/*
+    --liftover: finish index (every mutated chromosome added), write it as <mutated FA>.chain
+    and add the MUT_POS column to the record at record_path, verbose = false prints no summary line
+*/
+static void write_liftover(LiftoverIndex& index, const char* fasta, const std::string& tag, const char* record_path,
+                           bool verbose = true) {
+    StatTimer timer("liftover");
+    index.finish();
+    index.write_chain((mutated_filename(fasta, tag) + ".chain").c_str());
+    index.add_record_column(record_path);
+    if (verbose) {
+        std::cout << "Liftover index: " << index.block_count() << " blocks" << std::endl;
+    }
+}
+
+/*
+    mutate a copy of the ancestor chains with each rate of model multiplied by scale and write every output
+    of it under tag (FA, record, reads, chain), SNP go to an overlay so sequences and ancestor are only read
+    seed picks the RNG streams, verbose = false prints no progress lines
+*/
+static void simulate_haplotype(const RunOptions& opts, const MutationModel& model, double scale,
+                               std::vector<Sequence*>& sequences, const std::vector<LinkedSequence*>& ancestor,
+                               const std::string& tag, uint64_t seed, ThreadPool& workers,
+                               std::chrono::time_point<std::chrono::high_resolution_clock>& start,
+                               bool verbose = true) {
+    std::vector<LinkedSequence*> haplotype = clone_linkedseqs(ancestor);
+    SnpOverlay snps;
+    RecordSink mut_record(opts.fasta, record_path(opts, tag).c_str(), 1 << 20, record_bgzf_threads(opts));
+    apply_mutations(model, scale, sequences, haplotype, mut_record, seed, workers, &snps, start,
+                    PASS_SV, PASS_COUNT, opts.fused, verbose);
+
+    if (verbose) {
+        std::cout << "Start writing to output" << std::endl;
+    }
+    {
+        StatTimer timer("write");
+        write_mutated_ref(opts.fasta, haplotype, opts.line_width, opts.debug, tag, &snps,
+                          fasta_bgzf_threads(opts));
+    }
+    if (verbose) {
+        std::cout << "Complete writing to output" << std::endl;
+        output_performance(start);
+    }
+    if (opts.reads.coverage > 0.0) {
+        simulate_reads(opts, haplotype, tag, seed, workers, &snps, start, verbose);
+    }
+    mut_record.close();
+    if (opts.liftover) {
+        LiftoverIndex liftover(sequences);
+        for (LinkedSequence* head : haplotype) {
+            liftover.add_chain(head);
+        }
+        write_liftover(liftover, opts.fasta, tag, record_path(opts, tag).c_str(), verbose);
+    }
+    finish_record(opts, record_path(opts, tag));
+    free_linkedseqs(haplotype);
+}
+
+/*
+    --replicates: opts.replicates genomes mutated from the one parsed reference, replicate r with the
+    seed haplotype_seed(opts.seed, r) so it only depends on the base seed and r
+    replicates run side by side on workers, one thread each, and write their outputs tagged rep<r + 1>
+    (zero padded, ex. mut_ref_rep007.fa and mutation_record_rep007)
+*/
+static void simulate_replicates(const RunOptions& opts, const MutationModel& model,
+                                std::vector<Sequence*>& sequences, const std::vector<LinkedSequence*>& ancestor,
+                                ThreadPool& workers,
+                                std::chrono::time_point<std::chrono::high_resolution_clock>& start) {
+    // each replicate compresses and simulates reads on its own thread too
+    RunOptions replicate_opts = opts;
+    replicate_opts.threads = 1;
+    size_t width = std::to_string(opts.replicates).size();
+    std::mutex print_mutex;
+    std::cout << "Start simulate " << opts.replicates << " replicates" << std::endl;
+    parallel_for(workers, opts.replicates, [&](size_t r) {
+        std::string number = std::to_string(r + 1);
+        std::string tag = "rep" + std::string(width - number.size(), '0') + number;
+        ThreadPool inline_pool(1);
+        simulate_haplotype(replicate_opts, model, 1.0, sequences, ancestor, tag, haplotype_seed(opts.seed, r),
+                           inline_pool, start, false);
+        std::lock_guard<std::mutex> lock(print_mutex);
+        std::cout << "Complete replicate " << tag << std::endl;
+        output_performance(start);
+    });
+}
+
+/*
+    --stream: one FA record at a time through three stages running concurrently, so chromosome k+1
+    is read in while chromosome k mutates and chromosome k-1 is written out
+        reader: materialize the bases
+        mutate (calling thread, chunks still run on workers): CNV -> INDEL -> SNP
+        writer: write the mutated chromosome in order, then free its chain, bases and mapped pages
+    at most STREAM_IN_FLIGHT chromosomes are in memory, the reader waits for the writer to free one
+
+    every chromosome keeps the RNG streams of its index, and the records of each pass go to their own file,
+    joined in pass order at the end, so the output matches the batch mode for the same seed
+    SV are left out, an inter translocation needs two chromosomes at once
+*/
+void stream_mutations(const RunOptions& opts, MutationModel model,
+                      std::vector<Sequence*>& sequences,
+                      ThreadPool& workers,
+                      std::chrono::time_point<std::chrono::high_resolution_clock>& start) {
+    // one chromosome per stage
+    const size_t STREAM_IN_FLIGHT = 3;
+
+    if (model.sv.rate > 0.0) {
+        std::cerr << "--stream simulates no SV, same output as the batch mode with sv_rate 0" << std::endl;
+    }
+    std::string mut_path = mutated_filename(opts.fasta) + (opts.bgzf ? ".gz" : "");
+    FastaWriter mut_file(mut_path.c_str(), opts.line_width, 1 << 22, fasta_bgzf_threads(opts));
+    // CNV first like in the batch mode, INDEL and SNP records wait in their own files
+    const char* indel_path = "mutation_record.INDEL.part";
+    const char* snp_path = "mutation_record.SNP.part";
+    RecordSink mut_record(opts.fasta);
+    RecordSink indel_record(opts.fasta, indel_path);
+    RecordSink snp_record(opts.fasta, snp_path);
+    // reads of chromosome c are drawn right after it is mutated, before the writer frees it
+    std::unique_ptr<ReadSimulator> reads;
+    if (opts.reads.coverage > 0.0) {
+        reads.reset(new ReadSimulator(opts.reads, reads_prefix(opts.fasta, ""), opts.seed, fasta_bgzf_threads(opts)));
+    }
+
+    // chromosome indices flow reader -> mutate -> writer, chains[c] is only touched by the stage holding c
+    std::vector<LinkedSequence*> chains(sequences.size(), nullptr);
+    BoundedQueue<size_t> parsed(STREAM_IN_FLIGHT);
+    BoundedQueue<size_t> mutated(STREAM_IN_FLIGHT);
+    // one token per chromosome allowed in memory, taken by the reader and given back by the writer
+    BoundedQueue<int> slots(STREAM_IN_FLIGHT);
+    for (size_t i = 0; i < STREAM_IN_FLIGHT; i++) {
+        slots.push(0);
+    }
+
+    std::thread reader([&]() {
+        int token;
+        for (size_t c = 0; c < sequences.size() && slots.pop(token); c++) {
+            {
+                StatTimer timer("materialize");
+                sequences[c]->materialize();
+            }
+            parsed.push(c);
+        }
+        parsed.close();
+    });
+    // only the writer adds to it, in chromosome order
+    LiftoverIndex liftover(sequences);
+    std::thread writer([&]() {
+        size_t c;
+        while (mutated.pop(c)) {
+            if (opts.liftover) {
+                liftover.add_chain(chains[c]);
+            }
+            {
+                StatTimer timer("write");
+                if (mut_file.is_open()) {
+                    mut_file.write_header(chains[c]->get_seq_id());
+                    chains[c]->write_all(mut_file, opts.debug);
+                }
+            }
+            // done with this chromosome, drop its chain, its bases and its mapped pages
+            std::vector<LinkedSequence*> chain = {chains[c]};
+            free_linkedseqs(chain);
+            sequences[c]->release();
+            slots.push(0);
+            std::cout << "Complete chromosome " << sequences[c]->id << std::endl;
+            output_performance(start);
+        }
+    });
+
+    size_t c;
+    while (parsed.pop(c)) {
+        std::cout << "Start chromosome " << sequences[c]->id << std::endl;
+        std::vector<Sequence*> chrom = {sequences[c]};
+        std::vector<LinkedSequence*> linkedseqs = init_vector_LinkedSequence(chrom);
+        {
+            StatTimer timer("CNV");
+            gen_CNV(linkedseqs, mut_record, model.cnv, opts.seed, workers, SampleMode::GEOMETRIC, c);
+        }
+        if (opts.fused) {
+            // records of both go to the INDEL part, in mutated chromosome order
+            StatTimer timer("SNP_INDEL");
+            gen_SNP_INDEL(linkedseqs, indel_record, model.ins_prob, model.del_prob, model.ins_base_prob,
+                          model.indel_rate, model.snp_prob, model.snp_rate, opts.seed, workers,
+                          SampleMode::GEOMETRIC, DEFAULT_CHUNK_BASES, nullptr, c);
+        } else {
+            {
+                StatTimer timer("INDEL");
+                gen_INDEL(linkedseqs, indel_record, model.ins_prob, model.del_prob, model.ins_base_prob,
+                          model.indel_rate, opts.seed, workers, SampleMode::GEOMETRIC, DEFAULT_CHUNK_BASES, c);
+            }
+            StatTimer timer("SNP");
+            gen_SNP(chrom, snp_record, model.snp_prob, model.snp_rate, opts.seed, workers,
+                    SampleMode::GEOMETRIC, DEFAULT_CHUNK_BASES, nullptr, c);
+        }
+        if (reads != nullptr) {
+            StatTimer timer("reads");
+            reads->simulate(linkedseqs[0], c, workers);
+        }
+        chains[c] = linkedseqs[0];
+        mutated.push(c);
+    }
+    mutated.close();
+    reader.join();
+    writer.join();
 
-    // clean up
     mut_record.close();
+    indel_record.close();
+    snp_record.close();
+    join_record_file("mutation_record", indel_path);
+    join_record_file("mutation_record", snp_path);
+    if (opts.liftover) {
+        write_liftover(liftover, opts.fasta, "", "mutation_record");
+    }
+    finish_record(opts, "mutation_record");
+}
+
+// code for running gen mutation with LinekedSequence
+int gen_mutation(int argc, char* argv[], std::chrono::time_point<std::chrono::high_resolution_clock>& start) {
+
+    /*---------------command line parsing----------*/
+
+    RunOptions opts;
+    if (!parse_options(argc, argv, opts)) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    // read the model before any input, a bad model file fails fast
+    MutationModel model = default_model();
+    if (opts.model != nullptr && !load_model(opts.model, model)) {
+        return EXIT_FAILURE;
+    }
+    if (opts.bgzf && !bgzf_available()) {
+        std::cerr << "--bgzf needs zlib, built with ZLIB=0" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // progress lines on stderr until the end of the run, if asked for
+    StatProgress progress(opts.progress);
+
+    /*---------------input files parsing----------*/
+    std::vector<Sequence*> sequences;
+    // --load-snapshot: reference and LS chains as a previous run left them, passes resume from there
+    std::vector<LinkedSequence*> linkedseqs;
+    SnapshotInfo snapshot;
+    int first_pass = PASS_SV;
+    if (opts.load_snapshot != nullptr) {
+        std::cout << "Start loading snapshot" << std::endl;
+        {
+            StatTimer timer("snapshot");
+            if (!load_snapshot(opts.load_snapshot, opts.packed, sequences, linkedseqs, snapshot)) {
+                return EXIT_FAILURE;
+            }
+        }
+        // outputs are named after the FA of the run that wrote the snapshot unless one is given
+        if (opts.fasta == nullptr) {
+            opts.fasta = snapshot.fasta.c_str();
+        }
+        if (!opts.has_seed) {
+            opts.seed = snapshot.seed;
+            opts.has_seed = true;
+        }
+        first_pass = static_cast<int>(std::min<uint64_t>(snapshot.passes_done, PASS_COUNT));
+        if (opts.stop_after < first_pass - 1) {
+            std::cerr << "Snapshot already has the passes up to " << PASS_NAMES[first_pass - 1] << std::endl;
+            free_linkedseqs(linkedseqs);
+            free_vector(sequences);
+            return EXIT_FAILURE;
+        }
+        std::cout << "Complete loading snapshot: " << first_pass << " passes done" << std::endl;
+        output_performance(start);
+    } else {
+        // parse input fasta, mmap + index only, bases are copied in when a chromosome is first used
+        std::cout << "Start Parsing input fasta" << std::endl;
+        {
+            StatTimer timer("parse");
+            sequences = load_fasta(opts.fasta, opts.packed);
+        }
+        std::cout << "Complete Parsing input fasta" << std::endl;
+        output_performance(start);
+    }
+
+    // worker threads shared by every pass, 1 runs everything inline
+    ThreadPool workers(opts.threads);
+    // mutation setup, every pass derives its own RNG streams from the seed
+    if (!opts.has_seed) {
+        std::random_device rd;
+        opts.seed = (static_cast<uint64_t>(rd()) << 32) | rd();
+    }
+    std::cout << "Seed: " << opts.seed << ", threads: " << workers.size() << std::endl;
+
+    if (opts.stream) {
+        stream_mutations(opts, model, sequences, workers, start);
+        free_vector(sequences);
+        write_stats_report(opts.stats);
+        return EXIT_SUCCESS;
+    }
+
+    // copy the bases in now, one chromosome per task, the passes below assume it
+    {
+        StatTimer timer("materialize");
+        parallel_for(workers, sequences.size(), [&](size_t i) { sequences[i]->materialize(); });
+    }
+
+    if (opts.load_snapshot == nullptr) {
+        linkedseqs = init_vector_LinkedSequence(sequences);
+    }
+
+    /*---------------Add mutations----------*/
+
+    size_t haplotypes = opts.samples * opts.ploidy;
+    if (opts.replicates > 0) {
+        simulate_replicates(opts, model, sequences, linkedseqs, workers, start);
+    } else if (haplotypes == 1 && opts.shared == 0.0) {
+        // one genome, mutate the reference in place
+        // a resumed run records only the passes it runs, the earlier ones are in the record of the first run
+        RecordSink mut_record(opts.fasta, record_path(opts, "").c_str(), 1 << 20, record_bgzf_threads(opts));
+        apply_mutations(model, 1.0, sequences, linkedseqs, mut_record, opts.seed, workers, nullptr, start,
+                        first_pass, opts.stop_after + 1, opts.fused);
+        if (opts.save_snapshot != nullptr) {
+            std::cout << "Start writing snapshot" << std::endl;
+            {
+                StatTimer timer("snapshot");
+                snapshot.fasta = opts.fasta;
+                snapshot.seed = opts.seed;
+                snapshot.passes_done = opts.stop_after + 1;
+                save_snapshot(opts.save_snapshot, sequences, linkedseqs, snapshot);
+            }
+            std::cout << "Complete writing snapshot" << std::endl;
+            output_performance(start);
+        }
+
+        /*---------------Output mutated reference----------*/
+        std::cout << "Start writing to output" << std::endl;
+        {
+            StatTimer timer("write");
+            write_mutated_ref(opts.fasta, linkedseqs, opts.line_width, opts.debug, "", nullptr,
+                              fasta_bgzf_threads(opts));
+        }
+        std::cout << "Complete writing to output" << std::endl;
+        output_performance(start);
+        if (opts.reads.coverage > 0.0) {
+            simulate_reads(opts, linkedseqs, "", opts.seed, workers, nullptr, start);
+        }
+        mut_record.close();
+        if (opts.liftover) {
+            LiftoverIndex liftover(sequences);
+            for (LinkedSequence* head : linkedseqs) {
+                liftover.add_chain(head);
+            }
+            write_liftover(liftover, opts.fasta, "", "mutation_record");
+        }
+        finish_record(opts, record_path(opts, ""));
+    } else {
+        // shared ancestor first, written into the reference itself since every haplotype carries it
+        if (opts.shared > 0.0) {
+            std::cout << "Start simulate shared ancestor" << std::endl;
+            RecordSink mut_record(opts.fasta, record_path(opts, "").c_str(), 1 << 20, record_bgzf_threads(opts));
+            apply_mutations(model, opts.shared, sequences, linkedseqs, mut_record, opts.seed, workers, nullptr, start,
+                            PASS_SV, PASS_COUNT, opts.fused);
+            mut_record.close();
+            finish_record(opts, record_path(opts, ""));
+        }
+        // then one haplotype at a time, each is a copy of the ancestral LS chains plus its own SNP overlay
+        for (size_t h = 0; h < haplotypes; h++) {
+            std::string tag = "S" + std::to_string(h / opts.ploidy + 1);
+            if (opts.ploidy > 1) {
+                tag += "_H" + std::to_string(h % opts.ploidy + 1);
+            }
+            std::cout << "Start simulate haplotype " << tag << std::endl;
+            simulate_haplotype(opts, model, 1.0 - opts.shared, sequences, linkedseqs, tag,
+                               haplotype_seed(opts.seed, h), workers, start);
+        }
+    }
+
     // free objects
-    free_vector(linkedseqs);
+    free_linkedseqs(linkedseqs);
     free_vector(sequences);
+    write_stats_report(opts.stats);
     // ALL DONE
     return EXIT_SUCCESS;
 }
@@ -103,7 +747,9 @@ int main(int argc, char *argv[]) {
     auto start = std::chrono::high_resolution_clock::now();
 
     // CALL CHOICE OF MAIN HERE
-    gen_mutation(argc, argv, start);
+    if (gen_mutation(argc, argv, start) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
 
     output_performance(start);
     return EXIT_SUCCESS;
@@ -1,12 +1,21 @@
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <sstream>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bgzf.h"
 #include "io.h"
+#include "stats.h"
 
 /*---------------FA parsing---------------*/
 std::vector<Sequence*> parse_data(const char *file_path) {
@@ -31,6 +40,7 @@ std::vector<Sequence*> parse_data(const char *file_path) {
                 // Save the previous sequence before starting a new one
                 if (inSequence) {
                     currentSequence->data = new std::string(std::move(oss.str()));
+                    STAT_ADD(STAT_BYTES_PARSED, currentSequence->data->size());
                     oss.str("");  // Clear the buffer
                     sequences.push_back(currentSequence);
                 }
@@ -44,6 +54,7 @@ std::vector<Sequence*> parse_data(const char *file_path) {
         // Don't forget to save the last sequence
         if (inSequence) {
             currentSequence->data = new std::string(std::move(oss.str()));
+            STAT_ADD(STAT_BYTES_PARSED, currentSequence->data->size());
             oss.str("");  // Clear the buffer, not really need on last iteration
             sequences.push_back(currentSequence);
         }
@@ -54,14 +65,568 @@ std::vector<Sequence*> parse_data(const char *file_path) {
     return sequences;
 }
 
-std::ofstream init_mutation_record(const char *file_path) {
-    std::ofstream mut_record("mutation_record");
-    if (mut_record.is_open()) {
-        // set up header info for mutation record
-        mut_record << "##reference=" << file_path << std::endl;
-        mut_record << "#CHROM\tPOS\tREF\tALT\tINFO" << std::endl;
+/*---------------Base helpers---------------*/
+char complement_base(char base) {
+    switch (base) {
+        case 'A': return 'T';
+        case 'T': return 'A';
+        case 'C': return 'G';
+        case 'G': return 'C';
+        case 'a': return 't';
+        case 't': return 'a';
+        case 'c': return 'g';
+        case 'g': return 'c';
+        case 'R': return 'Y';
+        case 'Y': return 'R';
+        case 'K': return 'M';
+        case 'M': return 'K';
+        case 'B': return 'V';
+        case 'V': return 'B';
+        case 'D': return 'H';
+        case 'H': return 'D';
+        default: return base;  // N, S, W and anything unknown
+    }
+}
+
+void reverse_complement(char* bases, size_t n) {
+    // table built once, then one lookup per base
+    static const struct Table {
+        char map[256];
+        Table() {
+            for (int i = 0; i < 256; i++) {
+                map[i] = complement_base(static_cast<char>(i));
+            }
+        }
+    } table;
+    for (size_t i = 0, j = n; i < j; i++) {
+        j--;
+        char left = table.map[static_cast<unsigned char>(bases[i])];
+        bases[i] = table.map[static_cast<unsigned char>(bases[j])];
+        bases[j] = left;
+    }
+}
+
+/*---------------mmap FA loading---------------*/
+MappedFasta::MappedFasta(const char *file_path, bool index_fasta) : base_(nullptr), size_(0) {
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Unable to open fasta file" << std::endl;
+        return;
+    }
+    struct stat fa_stat;
+    if (fstat(fd, &fa_stat) != 0 || fa_stat.st_size == 0) {
+        std::cerr << "Unable to map fasta file" << std::endl;
+        close(fd);
+        return;
+    }
+    void* addr = mmap(nullptr, fa_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // mapping stays valid after close
+    if (addr == MAP_FAILED) {
+        std::cerr << "Unable to map fasta file" << std::endl;
+        return;
+    }
+    // bases are only ever read front to back
+    madvise(addr, fa_stat.st_size, MADV_SEQUENTIAL);
+    base_ = static_cast<const char*>(addr);
+    size_ = fa_stat.st_size;
+    if (!index_fasta) {
+        return;
+    }
+
+    // only trust an index that is at least as new as the FA
+    std::string fai_path = std::string(file_path) + ".fai";
+    struct stat fai_stat;
+    bool fresh = stat(fai_path.c_str(), &fai_stat) == 0 && fai_stat.st_mtime >= fa_stat.st_mtime;
+    if (!fresh || !read_index(fai_path.c_str())) {
+        build_index();
+        write_index(fai_path.c_str());
+        // the scan touched every page, let them go until a record is materialized
+        madvise(const_cast<char*>(base_), size_, MADV_DONTNEED);
+    }
+}
+
+MappedFasta::~MappedFasta() {
+    if (base_ != nullptr) {
+        munmap(const_cast<char*>(base_), size_);
+    }
+}
+
+void MappedFasta::release(size_t i) const {
+    // whole pages from the first base up to the next record, the ends may share a page with a neighbour
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t begin = records_[i].offset / page * page;
+    size_t end = i + 1 < records_.size() ? records_[i + 1].offset : size_;
+    if (end > begin) {
+        madvise(const_cast<char*>(base_) + begin, end - begin, MADV_DONTNEED);
+    }
+}
+
+bool MappedFasta::read_index(const char *fai_path) {
+    std::ifstream fai(fai_path);
+    std::string line;
+    std::vector<FaiRecord> records;
+    while (std::getline(fai, line)) {
+        std::istringstream iss(line);
+        FaiRecord rec;
+        if (!(std::getline(iss, rec.name, '\t') >> rec.length >> rec.offset >> rec.line_bases >> rec.line_bytes)) {
+            return false;
+        }
+        // reject an index that doesn't fit this file
+        if (rec.offset == 0 || rec.offset > size_ || base_[rec.offset - 1] != '\n' ||
+            rec.line_bases == 0 || rec.line_bytes < rec.line_bases) {
+            return false;
+        }
+        // a stale index may claim more bases than the file holds, reading them would run off the mapping
+        if (rec.length > 0) {
+            size_t last_line = (rec.length - 1) / rec.line_bases;
+            size_t room = size_ - rec.offset;
+            if (last_line > room / rec.line_bytes ||
+                last_line * rec.line_bytes + (rec.length - 1) % rec.line_bases >= room) {
+                return false;
+            }
+        }
+        records.push_back(rec);
+    }
+    records_ = std::move(records);
+    return true;
+}
+
+void MappedFasta::build_index() {
+    records_.clear();
+    const char* end = base_ + size_;
+    const char* p = base_;
+    FaiRecord* rec = nullptr;
+    size_t lines = 0;
+    // a line shorter than the width must be the last line of the record
+    bool short_line_seen = false;
+    while (p < end) {
+        const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+        const char* line_end = (nl == nullptr) ? end : nl;
+        const char* next = (nl == nullptr) ? end : nl + 1;
+        size_t bases = line_end - p;
+        if (bases > 0 && line_end[-1] == '\r') {
+            bases--;
+        }
+
+        if (*p == '>') {
+            const char* name_end = p + 1;
+            while (name_end < p + 1 + bases && !isspace(static_cast<unsigned char>(*name_end))) {
+                name_end++;
+            }
+            records_.push_back(FaiRecord{std::string(p + 1, name_end), 0, static_cast<size_t>(next - base_), 0, 0});
+            rec = &records_.back();
+            lines = 0;
+            short_line_seen = false;
+        } else if (rec != nullptr) {
+            if (lines == 0) {
+                // first line of the record sets the width
+                rec->line_bases = bases;
+                rec->line_bytes = (bases == 0) ? 0 : static_cast<size_t>(next - p);
+            } else if (short_line_seen || bases > rec->line_bases ||
+                       (nl != nullptr && static_cast<size_t>(next - p) - bases != rec->line_bytes - rec->line_bases)) {
+                // irregular widths or line endings, fall back to a scanning copy
+                rec->line_bytes = 0;
+            }
+            short_line_seen = short_line_seen || bases < rec->line_bases;
+            rec->length += bases;
+            lines++;
+        }
+        p = next;
+    }
+}
+
+void MappedFasta::write_index(const char *fai_path) const {
+    // a read only directory is fine, the in-memory index is enough
+    write_fai(fai_path, records_);
+}
+
+bool write_fai(const char *fai_path, const std::vector<FaiRecord>& records) {
+    for (const FaiRecord& rec : records) {
+        if (rec.line_bytes == 0) {
+            return true;  // samtools can't use an index of an irregular FA either
+        }
+    }
+    std::ofstream fai(fai_path);
+    if (!fai.is_open()) {
+        return false;
+    }
+    for (const FaiRecord& rec : records) {
+        fai << rec.name << '\t' << rec.length << '\t' << rec.offset << '\t'
+            << rec.line_bases << '\t' << rec.line_bytes << '\n';
+    }
+    return true;
+}
+
+std::string fasta_name(const std::string& header) {
+    size_t end = header.find_first_of(" \t");
+    return end == std::string::npos ? header : header.substr(0, end);
+}
+
+std::string MappedFasta::header(size_t i) const {
+    size_t offset = records_[i].offset;
+    // the header is the line right before the first base, it may contain '>' itself so look for the line start
+    const char* line_end = base_ + offset - 1;
+    const char* nl = static_cast<const char*>(memrchr(base_, '\n', offset - 1));
+    const char* gt = (nl == nullptr) ? base_ : nl + 1;
+    if (line_end > gt && line_end[-1] == '\r') {
+        line_end--;
+    }
+    return std::string(gt + 1, line_end);
+}
+
+void MappedFasta::visit_bases(size_t i, const std::function<void(const char*, size_t)>& visit) const {
+    const FaiRecord& rec = records_[i];
+    const char* src = base_ + rec.offset;
+    if (rec.line_bytes != 0) {
+        // regular widths, every line is at the same stride
+        size_t left = rec.length;
+        while (left > 0) {
+            size_t n = left < rec.line_bases ? left : rec.line_bases;
+            visit(src, n);
+            src += rec.line_bytes;
+            left -= n;
+        }
+        return;
+    }
+    // irregular widths, hand over whatever sits between line breaks
+    const char* end = base_ + size_;
+    size_t left = rec.length;
+    while (left > 0 && src < end) {
+        const char* nl = static_cast<const char*>(memchr(src, '\n', end - src));
+        const char* line_end = (nl == nullptr) ? end : nl;
+        size_t n = line_end - src;
+        if (n > 0 && line_end[-1] == '\r') {
+            n--;
+        }
+        visit(src, n);
+        left -= n;
+        src = line_end + 1;
+    }
+}
+
+void MappedFasta::copy_bases(size_t i, char* out) const {
+    visit_bases(i, [&out](const char* bases, size_t n) {
+        memcpy(out, bases, n);
+        out += n;
+    });
+}
+
+void Sequence::materialize() {
+    if (data != nullptr || packed != nullptr) {
+        return;
+    }
+    if (pack_on_load) {
+        // pack line by line straight out of the mapping, no unpacked copy is ever made
+        packed = new PackedBases();
+        packed->reserve(source->records()[record].length);
+        source->visit_bases(record, [this](const char* bases, size_t n) { packed->append(bases, n); });
+    } else {
+        data = new std::string(source->records()[record].length, '\0');
+        source->copy_bases(record, &(*data)[0]);
+    }
+    STAT_ADD(STAT_BYTES_PARSED, source->records()[record].length);
+}
+
+void Sequence::release() {
+    assert(source != nullptr && "Only Sequence from load_fasta can be released");
+    delete data;
+    delete packed;
+    data = nullptr;
+    packed = nullptr;
+    source->release(record);
+}
+
+void Sequence::copy_bases(size_t pos, size_t n, char* out) {
+    materialize();
+    if (data != nullptr) {
+        memcpy(out, data->data() + pos, n);
     } else {
+        packed->copy_to(pos, n, out);
+    }
+}
+
+std::vector<Sequence*> load_fasta(const char *file_path, bool packed) {
+    std::vector<Sequence*> sequences;
+    std::shared_ptr<const MappedFasta> fasta = std::make_shared<MappedFasta>(file_path);
+    if (!fasta->is_open()) {
+        return sequences;
+    }
+    for (size_t i = 0; i < fasta->records().size(); i++) {
+        if (fasta->records()[i].length == 0) {
+            continue;  // nothing to mutate, unlike parse_data an empty record is left out of the output
+        }
+        sequences.push_back(new Sequence(fasta->header(i), fasta, i, packed));
+    }
+    return sequences;
+}
+
+/*---------------FA writing---------------*/
+FastaWriter::FastaWriter(const char *file_path, size_t line_width, size_t buffer_size, size_t bgzf_threads)
+    : file_(nullptr), path_(file_path), buffer_(buffer_size), used_(0),
+      line_width_(line_width), column_(0), in_record_(false), offset_(0) {
+    if (bgzf_threads > 0) {
+        bgzf_.reset(new BgzfWriter(file_path, bgzf_threads));
+        if (!bgzf_->is_open()) {
+            bgzf_.reset();
+        }
+    } else {
+        file_ = fopen(file_path, "wb");
+    }
+    if (!is_open()) {
+        std::cerr << "Unable to open mutated output file" << std::endl;
+    }
+}
+
+FastaWriter::~FastaWriter() {
+    if (!is_open()) {
+        return;
+    }
+    end_record();
+    flush();
+    if (file_ != nullptr) {
+        fclose(file_);
+    }
+    // offsets in the .fai are into the uncompressed text, the .gzi maps them to BGZF blocks
+    if (bgzf_ != nullptr && bgzf_->close()) {
+        bgzf_->write_index((path_ + ".gzi").c_str());
+        if (!write_fai((path_ + ".fai").c_str(), index_)) {
+            std::cerr << "Unable to write " << path_ << ".fai" << std::endl;
+        }
+    }
+}
+
+void FastaWriter::append(const char* src, size_t n) {
+    offset_ += n;
+    while (n > 0) {
+        if (used_ == buffer_.size()) {
+            flush();
+        }
+        size_t chunk = std::min(n, buffer_.size() - used_);
+        memcpy(buffer_.data() + used_, src, chunk);
+        used_ += chunk;
+        src += chunk;
+        n -= chunk;
+    }
+}
+
+void FastaWriter::flush() {
+    if (used_ == 0) {
+        return;
+    }
+    if (bgzf_ != nullptr) {
+        bgzf_->write(buffer_.data(), used_);
+        used_ = 0;
+        return;
+    }
+    size_t written;
+    STAT_TIMED(STAT_WRITE_NS, written = fwrite(buffer_.data(), 1, used_, file_));
+    STAT_ADD(STAT_BYTES_WRITTEN, written);
+    if (written != used_) {
+        std::cerr << "Unable to write mutated output file" << std::endl;
+    }
+    used_ = 0;
+}
+
+void FastaWriter::write_header(const std::string& id) {
+    end_record();
+    append(">", 1);
+    append(id.data(), id.size());
+    append("\n", 1);
+    in_record_ = true;
+    column_ = 0;
+    index_.push_back(FaiRecord{fasta_name(id), 0, offset_, line_width_, line_width_ + 1});
+}
+
+void FastaWriter::write_bases(const char* bases, size_t n) {
+    if (!index_.empty()) {
+        index_.back().length += n;
+    }
+    if (line_width_ == 0) {
+        append(bases, n);
+        column_ += n;
+        return;
+    }
+    while (n > 0) {
+        if (column_ == line_width_) {
+            append("\n", 1);
+            column_ = 0;
+        }
+        size_t chunk = std::min(n, line_width_ - column_);
+        append(bases, chunk);
+        column_ += chunk;
+        bases += chunk;
+        n -= chunk;
+    }
+}
+
+void FastaWriter::write_raw(const char* text, size_t n) {
+    append(text, n);
+    if (!index_.empty()) {
+        index_.back().line_bytes = 0;  // lines no longer hold line_width bases each
+    }
+}
+
+void FastaWriter::end_record() {
+    if (in_record_) {
+        // one line per record (or one short line), the line is as long as the record
+        FaiRecord& rec = index_.back();
+        if (rec.line_bytes != 0 && (line_width_ == 0 || rec.length < line_width_)) {
+            rec.line_bases = rec.length;
+            rec.line_bytes = rec.length + 1;
+        }
+        append("\n", 1);
+        in_record_ = false;
+        column_ = 0;
+    }
+}
+
+/*---------------Mutation record---------------*/
+const char* mutation_type_name(MutationType type) {
+    switch (type) {
+        case MutationType::SNP: return "SNP";
+        case MutationType::INS: return "INS";
+        case MutationType::DEL: return "DEL";
+        case MutationType::CNV_AMP: return "CNV_AMP";
+        case MutationType::CNV_DEL: return "CNV_DEL";
+        case MutationType::SV_INV: return "SV_INV";
+        case MutationType::SV_TRA: return "SV_TRA";
+        case MutationType::SV_BAL: return "SV_BAL";
+    }
+    return ".";
+}
+
+void RecordBuffer::emit(const std::string& chrom, size_t pos, const char* ref, size_t ref_len,
+                        const char* alt, size_t alt_len, MutationType type, const std::string& extra) {
+    // bases of an inserted Sequence have no chromosome, they are recorded at a reference base instead
+    assert(!chrom.empty() && "Record without a chromosome");
+    STAT_ADD(STAT_MUTATIONS + static_cast<int>(type), 1);
+    // format pos backwards into a small buffer, no locale or stream state involved
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[sizeof(digits) - 1 - n++] = static_cast<char>('0' + pos % 10);
+        pos /= 10;
+    } while (pos != 0);
+
+    text_.append(chrom);
+    text_ += '\t';
+    text_.append(digits + sizeof(digits) - n, n);
+    text_ += '\t';
+    text_.append(ref, ref_len);
+    text_ += '\t';
+    text_.append(alt, alt_len);
+    text_ += '\t';
+    text_.append(mutation_type_name(type));
+    if (!extra.empty()) {
+        text_ += ';';
+        text_.append(extra);
+    }
+    text_ += '\n';
+}
+
+RecordSink::RecordSink(const char *ref_path, const char *record_path, size_t buffer_size, size_t bgzf_threads)
+    : file_(nullptr), buffer_size_(buffer_size), closing_(false) {
+    if (bgzf_threads > 0) {
+        bgzf_.reset(new BgzfWriter(record_path, bgzf_threads));
+        if (!bgzf_->is_open()) {
+            bgzf_.reset();
+        }
+    } else {
+        file_ = fopen(record_path, "wb");
+    }
+    if (!is_open()) {
         std::cerr << "Unable to open mutation record file" << std::endl;
+        return;
+    }
+    // set up header info for mutation record
+    std::string& text = current_.text();
+    text.reserve(buffer_size_ + 256);
+    text += "##reference=";
+    text += ref_path;
+    text += "\n#CHROM\tPOS\tREF\tALT\tINFO\n";
+    writer_ = std::thread(&RecordSink::writer_loop, this);
+}
+
+RecordSink::~RecordSink() {
+    close();
+}
+
+void RecordSink::append(RecordBuffer& records) {
+    if (current_.empty() && records.size() >= buffer_size_) {
+        // already a full buffer, queue it as is instead of copying
+        std::swap(current_.text(), records.text());
+        hand_off();
+        return;
     }
-    return mut_record;
-}
\ No newline at end of file
+    current_.text().append(records.text());
+    hand_off_if_full();
+}
+
+void RecordSink::hand_off() {
+    if (!is_open()) {
+        current_.clear();
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    STAT_TIMED(STAT_BLOCKED_NS, changed_.wait(lock, [this] { return full_.size() < MAX_IN_FLIGHT; }));
+    full_.push_back(std::move(current_.text()));
+    // reuse a buffer the writer is done with, keeps its capacity
+    current_.text() = std::string();
+    if (!spare_.empty()) {
+        std::swap(current_.text(), spare_.back());
+        spare_.pop_back();
+    }
+    current_.clear();
+    lock.unlock();
+    changed_.notify_all();
+}
+
+void RecordSink::writer_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        changed_.wait(lock, [this] { return closing_ || !full_.empty(); });
+        if (full_.empty()) {
+            return;  // closing and nothing left to write
+        }
+        std::string buffer = std::move(full_.front());
+        full_.pop_front();
+        lock.unlock();
+        if (bgzf_ != nullptr) {
+            bgzf_->write(buffer.data(), buffer.size());
+        } else {
+            size_t written;
+            STAT_TIMED(STAT_WRITE_NS, written = fwrite(buffer.data(), 1, buffer.size(), file_));
+            STAT_ADD(STAT_BYTES_WRITTEN, written);
+            if (written != buffer.size()) {
+                std::cerr << "Unable to write mutation record file" << std::endl;
+            }
+        }
+        buffer.clear();
+        lock.lock();
+        spare_.push_back(std::move(buffer));
+        changed_.notify_all();
+    }
+}
+
+void RecordSink::close() {
+    if (!is_open()) {
+        return;
+    }
+    if (!current_.empty()) {
+        hand_off();
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        closing_ = true;
+    }
+    changed_.notify_all();
+    writer_.join();
+    if (file_ != nullptr) {
+        fclose(file_);
+        file_ = nullptr;
+    }
+    if (bgzf_ != nullptr) {
+        bgzf_->close();
+        bgzf_.reset();
+    }
+}
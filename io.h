@@ -1,21 +1,215 @@
 #ifndef IO_H
 #define IO_H
 
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "packedBases.h"
+
+class BgzfWriter;
+
+/*
+    One entry of a .fai style index, same columns as samtools faidx
+    name: header up to the first whitespace
+    length: number of bases
+    offset: byte offset of the first base in the FA file
+    line_bases/line_bytes: bases per line and bytes per line (including "\n" or "\r\n")
+                           line_bytes == 0 marks a record with irregular line widths
+*/
+struct FaiRecord {
+    std::string name;
+    size_t length;
+    size_t offset;
+    size_t line_bases;
+    size_t line_bytes;
+};
+
+/*
+    write records as a .fai file at fai_path, nothing if one of them has irregular line widths (line_bytes == 0)
+    return false if the file couldn't be written
+*/
+bool write_fai(const char *fai_path, const std::vector<FaiRecord>& records);
+
+/*
+    FA name of a header line, everything up to the first whitespace
+*/
+std::string fasta_name(const std::string& header);
+
+/*
+    Read-only memory mapping of a FA file plus its .fai style index
+    the index is read from <fasta>.fai if it is present and up to date,
+    otherwise it is built by scanning the mapping once (and written out for the next run)
+
+    index_fasta = false only maps the file, the caller lays out the records with set_records
+    (ex. the base section of a snapshot, one line per record)
+*/
+class MappedFasta {
+    public:
+        explicit MappedFasta(const char *file_path, bool index_fasta = true);
+        ~MappedFasta();
+
+        MappedFasta(const MappedFasta&) = delete;
+        MappedFasta& operator=(const MappedFasta&) = delete;
+
+        bool is_open() const {
+            return base_ != nullptr;
+        }
+
+        const std::vector<FaiRecord>& records() const {
+            return records_;
+        }
+
+        // records of a file mapped with index_fasta = false, in file order, before any Sequence uses them
+        void set_records(std::vector<FaiRecord> records) {
+            records_ = std::move(records);
+        }
+
+        // the whole mapped file
+        const char* bytes() const {
+            return base_;
+        }
+
+        size_t file_size() const {
+            return size_;
+        }
+
+        /*
+            return the full header line (without '>') of record i
+        */
+        std::string header(size_t i) const;
+
+        /*
+            Copy the bases of record i into out, stripping "\n" and "\r"
+            out must hold at least records()[i].length chars
+        */
+        void copy_bases(size_t i, char* out) const;
+
+        /*
+            call visit(bases, n) for every run of bases of record i in order, line breaks stripped
+        */
+        void visit_bases(size_t i, const std::function<void(const char*, size_t)>& visit) const;
+
+        /*
+            drop the mapped pages of record i from memory, they are read from the file again if used
+            a record that was copied out no longer has to count towards the resident set
+        */
+        void release(size_t i) const;
+
+    private:
+        const char* base_;
+        size_t size_;
+        std::vector<FaiRecord> records_;
+
+        bool read_index(const char *fai_path);
+        void build_index();
+        void write_index(const char *fai_path) const;
+};
+
+/*
+    return the complement of base, upper/lower case and IUPAC codes are kept, anything else is returned as is
+*/
+char complement_base(char base);
+
+/*
+    reverse complement n bases in place
+*/
+void reverse_complement(char* bases, size_t n);
+
 /*
     Class representing a sequence of DNA, which holds a string id (could be empty if Sequence is created from INS)
-    and a string* to memory on stack
+    and a string* to memory on stack, or the same bases 2 bit packed in packed
+
+    Sequence loaded through load_fasta starts with data == packed == nullptr and only points into the mapped file,
+    call materialize() to copy the bases in on first use (packed if pack_on_load is set)
+    use the accessors below instead of data directly, they work for both storages
 */
 struct Sequence{
     std::string id;
     std::string* data;
+    PackedBases* packed;
+    // lazy source, only set for Sequence created by load_fasta
+    std::shared_ptr<const MappedFasta> source;
+    size_t record;
+    bool pack_on_load;
 
-    Sequence() : Sequence("", nullptr) {}
+    Sequence() : Sequence("", static_cast<std::string*>(nullptr)) {}
 
-    Sequence(std::string id_, std::string* data_):id(id_), data(data_) {}
+    Sequence(std::string id_, std::string* data_)
+        : id(id_), data(data_), packed(nullptr), record(0), pack_on_load(false) {}
+
+    Sequence(std::string id_, PackedBases* packed_)
+        : id(id_), data(nullptr), packed(packed_), record(0), pack_on_load(true) {}
+
+    Sequence(std::string id_, std::shared_ptr<const MappedFasta> source_, size_t record_, bool pack_on_load_)
+        : id(id_), data(nullptr), packed(nullptr), source(source_), record(record_), pack_on_load(pack_on_load_) {}
 
     ~Sequence(){
         delete data;
+        delete packed;
+    }
+
+    /*
+        number of bases, does not materialize the data
+    */
+    size_t size() const {
+        if (data != nullptr) {
+            return data->size();
+        }
+        return packed != nullptr ? packed->size() : source->records()[record].length;
+    }
+
+    bool is_packed() const {
+        return pack_on_load;
     }
+
+    /*
+        copy the bases out of the mapped file into data or packed, nothing to do after the first call
+        not thread safe, materialize up front before sharing a Sequence between threads
+    */
+    void materialize();
+
+    /*
+        return pointer to the unpacked bases starting at pos, nullptr if the storage is packed
+    */
+    const char* plain_bases(size_t pos) {
+        materialize();
+        return data != nullptr ? data->data() + pos : nullptr;
+    }
+
+    char base_at(size_t pos) {
+        materialize();
+        return data != nullptr ? (*data)[pos] : packed->at(pos);
+    }
+
+    /*
+        overwrite one base, c must be one of ACGT
+    */
+    void set_base(size_t pos, char c) {
+        materialize();
+        if (data != nullptr) {
+            (*data)[pos] = c;
+        } else {
+            packed->set(pos, c);
+        }
+    }
+
+    /*
+        copy (unpacking if needed) n bases starting at pos into out
+    */
+    void copy_bases(size_t pos, size_t n, char* out);
+
+    /*
+        free the materialized bases and the mapped pages behind them, the next use materializes again
+        only for Sequence created by load_fasta, any change made to the bases is lost
+    */
+    void release();
 };
 
 /*
@@ -27,9 +221,17 @@ struct Sequence{
 */
 std::vector<Sequence*> parse_data(const char *file_path);
 
+/*
+    Same result as parse_data, but the FA file is memory mapped and indexed instead of read line by line
+    no bases are copied here, each Sequence is materialized on first use
+    packed = true stores every Sequence 2 bit packed instead of one char per base
+    Caller is responsible for freeing the resource, the mapping is released with the last Sequence
+*/
+std::vector<Sequence*> load_fasta(const char *file_path, bool packed = false);
+
 /*
     Template function to free all vector stored resources
-    ~LS and ~Sequence will handle freeing resources they own
+    ~Sequence will handle freeing resources it owns, LS are freed with free_linkedseqs instead
 */
 template <typename T>
 void free_vector(std::vector<T*>& vec) {
@@ -39,11 +241,198 @@ void free_vector(std::vector<T*>& vec) {
 }
 
 /*
-    create mutation record file and write the header line
-    TODO: right now the output file name is "mutation record", can change in future to
-          some variation of the input .FA filename
-          take a look at first few lines in write_mutated_ref in LS.cc
+    Buffered FA writer, bases are copied into one large reusable buffer and handed to fwrite when it fills
+    sequence lines are wrapped every line_width bases, line_width == 0 writes each record on one line
+    extra memory is O(buffer_size) no matter how long the records are
+
+    bgzf_threads > 0 writes BGZF instead (compressed on that many threads) plus <file_path>.fai and
+    <file_path>.gzi, so samtools faidx can read the output without recompressing it
+*/
+class FastaWriter {
+    public:
+        FastaWriter(const char *file_path, size_t line_width = 60, size_t buffer_size = 1 << 22,
+                    size_t bgzf_threads = 0);
+        // flushes and closes the file
+        ~FastaWriter();
+
+        FastaWriter(const FastaWriter&) = delete;
+        FastaWriter& operator=(const FastaWriter&) = delete;
+
+        bool is_open() const {
+            return file_ != nullptr || bgzf_ != nullptr;
+        }
+
+        /*
+            start a new record, ends the previous one if needed
+        */
+        void write_header(const std::string& id);
+
+        /*
+            append n bases to the current record, wrapping lines as needed
+        */
+        void write_bases(const char* bases, size_t n);
+
+        /*
+            append text that doesn't count towards the line width (ex. "->" debug delimiters)
+        */
+        void write_raw(const char* text, size_t n);
+
+        /*
+            terminate the last line of the current record
+        */
+        void end_record();
+
+        void flush();
+
+    private:
+        FILE* file_;
+        std::unique_ptr<BgzfWriter> bgzf_;
+        std::string path_;
+        std::vector<char> buffer_;
+        size_t used_;
+        size_t line_width_;
+        size_t column_;
+        bool in_record_;
+        // bytes appended so far and the .fai entry of every record, only kept for BGZF output
+        size_t offset_;
+        std::vector<FaiRecord> index_;
+
+        void append(const char* src, size_t n);
+};
+
+/*
+    Kind of mutation, written to the INFO column of the mutation record
+*/
+enum class MutationType {
+    SNP,
+    INS,
+    DEL,
+    CNV_AMP,
+    CNV_DEL,
+    SV_INV,
+    SV_TRA,
+    SV_BAL
+};
+
+// number of MutationType values, keep in sync with the enum
+constexpr int MUTATION_TYPE_COUNT = static_cast<int>(MutationType::SV_BAL) + 1;
+
+const char* mutation_type_name(MutationType type);
+
+/*
+    Growable text buffer of mutation record lines, formatted without iostream
+    workers fill their own RecordBuffer and hand it to RecordSink::append in a fixed order
+*/
+class RecordBuffer {
+    public:
+        /*
+            append one record line
+            chrom pos ref alt info
+            info is the type name, followed by ";" and extra if given (ex. "CNV_AMP;LEN=1000;CN=3")
+        */
+        void emit(const std::string& chrom, size_t pos, const char* ref, size_t ref_len,
+                  const char* alt, size_t alt_len, MutationType type, const std::string& extra = std::string());
+
+        void emit(const std::string& chrom, size_t pos, const std::string& ref, const std::string& alt,
+                  MutationType type, const std::string& extra = std::string()) {
+            emit(chrom, pos, ref.data(), ref.size(), alt.data(), alt.size(), type, extra);
+        }
+
+        void emit(const std::string& chrom, size_t pos, char ref, char alt, MutationType type) {
+            emit(chrom, pos, &ref, 1, &alt, 1, type);
+        }
+
+        size_t size() const {
+            return text_.size();
+        }
+
+        bool empty() const {
+            return text_.empty();
+        }
+
+        void clear() {
+            text_.clear();
+        }
+
+        std::string& text() {
+            return text_;
+        }
+
+    private:
+        std::string text_;
+};
+
+/*
+    Mutation record file, replaces writing record lines one by one into an ofstream
+    records are formatted into a large reusable buffer, full buffers are handed to a background
+    thread that does the fwrite, so the mutation passes never wait on a syscall per record
+    at most a few buffers are in flight, emit blocks if the disk falls behind
+
+    everything emitted is on disk once close() returns, ~RecordSink calls close()
 */
-std::ofstream init_mutation_record(const char *file_path);
+class RecordSink {
+    public:
+        /*
+            create the mutation record file at record_path and write the header line
+            ref_path goes in the header, bgzf_threads > 0 writes the file BGZF compressed on that many threads
+        */
+        explicit RecordSink(const char *ref_path, const char *record_path = "mutation_record",
+                            size_t buffer_size = 1 << 20, size_t bgzf_threads = 0);
+        ~RecordSink();
+
+        RecordSink(const RecordSink&) = delete;
+        RecordSink& operator=(const RecordSink&) = delete;
+
+        bool is_open() const {
+            return file_ != nullptr || bgzf_ != nullptr;
+        }
+
+        /*
+            write one record
+        */
+        void emit(const std::string& chrom, size_t pos, const std::string& ref, const std::string& alt,
+                  MutationType type) {
+            current_.emit(chrom, pos, ref, alt, type);
+            hand_off_if_full();
+        }
+
+        void emit(const std::string& chrom, size_t pos, char ref, char alt, MutationType type) {
+            current_.emit(chrom, pos, ref, alt, type);
+            hand_off_if_full();
+        }
+
+        /*
+            write every record of records, in order
+        */
+        void append(RecordBuffer& records);
+
+        /*
+            write out everything emitted so far and stop the writer thread
+        */
+        void close();
+
+    private:
+        // buffers queued or being written at most, bounds memory if the disk is slow
+        static constexpr size_t MAX_IN_FLIGHT = 4;
+
+        FILE* file_;
+        std::unique_ptr<BgzfWriter> bgzf_;
+        size_t buffer_size_;
+        RecordBuffer current_;
+        std::deque<std::string> full_;
+        std::vector<std::string> spare_;
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        std::thread writer_;
+        bool closing_;
+
+        void hand_off_if_full() {
+            if (current_.size() >= buffer_size_) {
+                hand_off();
+            }
+        }
+        void hand_off();
+        void writer_loop();
+};
 
 #endif // IO_H
\ No newline at end of file
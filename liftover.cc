@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "liftover.h"
+
+LiftoverIndex::LiftoverIndex(const std::vector<Sequence*>& reference)
+    : reference_(reference.begin(), reference.end()), by_ref_(reference.size()) {
+    for (uint32_t i = 0; i < reference.size(); i++) {
+        ref_index_[reference[i]] = i;
+        ref_names_[reference[i]->id] = i;
+    }
+}
+
+void LiftoverIndex::add_chain(const LinkedSequence* head) {
+    std::vector<Block> blocks;
+    size_t mut_pos = 0;
+    for (const LinkedSequence* ls = head; ls != nullptr; ls = ls->get_next()) {
+        if (ls->is_empty()) {
+            continue;
+        }
+        auto found = ref_index_.find(ls->get_seq());
+        uint32_t ref_chrom = found == ref_index_.end() ? NO_REF : found->second;
+        bool reversed = ls->is_reversed();
+        // lowest Sequence position of the LS, its visible front for a forward one
+        size_t ref_start = reversed ? ls->seq_pos(ls->size() - 1) : ls->seq_pos(0);
+        Block* last = blocks.empty() ? nullptr : &blocks.back();
+        bool continues = last != nullptr && last->ref_chrom == ref_chrom && ref_chrom != NO_REF &&
+                         last->reversed == reversed &&
+                         (reversed ? ref_start + ls->size() == last->ref_start
+                                   : last->ref_start + last->len == ref_start);
+        if (continues) {
+            last->len += ls->size();
+            if (reversed) {
+                last->ref_start = ref_start;
+            }
+        } else {
+            blocks.push_back(Block{mut_pos, ref_chrom == NO_REF ? 0 : ref_start, ls->size(), ref_chrom, reversed});
+        }
+        mut_pos += ls->size();
+    }
+    uint32_t mut_chrom = static_cast<uint32_t>(blocks_.size());
+    for (uint32_t b = 0; b < blocks.size(); b++) {
+        if (blocks[b].ref_chrom != NO_REF) {
+            by_ref_[blocks[b].ref_chrom].covers.push_back(RefCover{mut_chrom, b});
+        }
+    }
+    blocks_.push_back(std::move(blocks));
+    mut_names_.push_back(fasta_name(head->get_seq_id()));
+    mut_sizes_.push_back(mut_pos);
+}
+
+void LiftoverIndex::finish() {
+    for (RefSide& side : by_ref_) {
+        std::vector<RefCover> blocks;
+        blocks.swap(side.covers);
+        auto start = [&](const RefCover& cover) { return blocks_[cover.mut_chrom][cover.block].ref_start; };
+        auto end = [&](const RefCover& cover) {
+            const Block& block = blocks_[cover.mut_chrom][cover.block];
+            return block.ref_start + block.len;
+        };
+        std::sort(blocks.begin(), blocks.end(), [&](const RefCover& a, const RefCover& b) {
+            return start(a) < start(b);
+        });
+        // every block start and end cuts an interval
+        std::vector<size_t> cuts;
+        for (const RefCover& cover : blocks) {
+            cuts.push_back(start(cover));
+            cuts.push_back(end(cover));
+        }
+        std::sort(cuts.begin(), cuts.end());
+        cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+        // sweep the cuts in order, the blocks open at a cut cover the interval it starts
+        std::vector<RefCover> open;
+        size_t next = 0;
+        for (size_t cut : cuts) {
+            auto closed = [&](const RefCover& cover) { return end(cover) <= cut; };
+            open.erase(std::remove_if(open.begin(), open.end(), closed), open.end());
+            for (; next < blocks.size() && start(blocks[next]) == cut; next++) {
+                open.push_back(blocks[next]);
+            }
+            side.starts.push_back(cut);
+            side.first.push_back(side.covers.size());
+            side.covers.insert(side.covers.end(), open.begin(), open.end());
+        }
+        side.first.push_back(side.covers.size());
+    }
+}
+
+bool LiftoverIndex::mut_to_ref(size_t mut_chrom, size_t mut_pos, Position& out) const {
+    assert(mut_chrom < blocks_.size() && mut_pos < mut_sizes_[mut_chrom] && "Invalid mutated position");
+    const std::vector<Block>& blocks = blocks_[mut_chrom];
+    // last block starting at or before mut_pos
+    auto it = std::upper_bound(blocks.begin(), blocks.end(), mut_pos,
+                               [](size_t pos, const Block& block) { return pos < block.mut_start; });
+    const Block& block = *(it - 1);
+    if (block.ref_chrom == NO_REF) {
+        return false;
+    }
+    size_t offset = mut_pos - block.mut_start;
+    out.chrom = block.ref_chrom;
+    out.pos = block.reversed ? block.ref_start + block.len - 1 - offset : block.ref_start + offset;
+    out.reversed = block.reversed;
+    return true;
+}
+
+void LiftoverIndex::ref_to_mut(size_t ref_chrom, size_t ref_pos, std::vector<Position>& out) const {
+    assert(ref_chrom < by_ref_.size() && "Invalid reference chromosome");
+    out.clear();
+    const RefSide& side = by_ref_[ref_chrom];
+    // the interval holding ref_pos, none before the first start or from the last one on
+    size_t i = std::upper_bound(side.starts.begin(), side.starts.end(), ref_pos) - side.starts.begin();
+    if (i == 0 || i == side.starts.size()) {
+        return;
+    }
+    i--;
+    for (size_t c = side.first[i]; c < side.first[i + 1]; c++) {
+        const RefCover& cover = side.covers[c];
+        const Block& block = blocks_[cover.mut_chrom][cover.block];
+        size_t offset = ref_pos - block.ref_start;
+        size_t mut_pos = block.reversed ? block.mut_start + block.len - 1 - offset : block.mut_start + offset;
+        out.push_back(Position{cover.mut_chrom, mut_pos, block.reversed});
+    }
+    std::sort(out.begin(), out.end(), [](const Position& a, const Position& b) {
+        return a.chrom != b.chrom ? a.chrom < b.chrom : a.pos < b.pos;
+    });
+}
+
+long LiftoverIndex::ref_chrom_of(const std::string& id) const {
+    auto found = ref_names_.find(id);
+    return found == ref_names_.end() ? -1 : static_cast<long>(found->second);
+}
+
+size_t LiftoverIndex::block_count() const {
+    size_t count = 0;
+    for (const std::vector<Block>& blocks : blocks_) {
+        count += blocks.size();
+    }
+    return count;
+}
+
+bool LiftoverIndex::write_chain(const char* path) const {
+    FILE* file = fopen(path, "w");
+    if (file == nullptr) {
+        std::cerr << "Unable to write chain file " << path << std::endl;
+        return false;
+    }
+    size_t id = 0;
+    for (size_t q = 0; q < blocks_.size(); q++) {
+        const std::vector<Block>& blocks = blocks_[q];
+        size_t q_size = mut_sizes_[q];
+        size_t b = 0;
+        while (b < blocks.size()) {
+            if (blocks[b].ref_chrom == NO_REF) {
+                b++;  // inserted bases only show up as query gaps
+                continue;
+            }
+            // extend the run while blocks keep the chromosome and orientation and go forward in the reference
+            // (backward for an inverted run, which goes forward on the - strand of the query)
+            std::vector<const Block*> run = {&blocks[b]};
+            size_t next = b + 1;
+            for (; next < blocks.size(); next++) {
+                const Block& block = blocks[next];
+                if (block.ref_chrom == NO_REF) {
+                    continue;
+                }
+                const Block& last = *run.back();
+                bool forward = block.ref_chrom == last.ref_chrom && block.reversed == last.reversed &&
+                               (block.reversed ? block.ref_start + block.len <= last.ref_start
+                                               : block.ref_start >= last.ref_start + last.len);
+                if (!forward) {
+                    break;
+                }
+                run.push_back(&block);
+            }
+            bool minus = run.front()->reversed;
+            if (minus) {
+                std::reverse(run.begin(), run.end());
+            }
+            // query coordinates on the strand of the chain
+            auto q_start = [&](const Block* block) {
+                return minus ? q_size - (block->mut_start + block->len) : block->mut_start;
+            };
+            const Sequence* target = reference_[run.front()->ref_chrom];
+            size_t score = 0;
+            for (const Block* block : run) {
+                score += block->len;
+            }
+            fprintf(file, "chain %zu %s %zu + %zu %zu %s %zu %c %zu %zu %zu\n", score,
+                    fasta_name(target->id).c_str(), target->size(), run.front()->ref_start,
+                    run.back()->ref_start + run.back()->len, mut_names_[q].c_str(), q_size, minus ? '-' : '+',
+                    q_start(run.front()), q_start(run.back()) + run.back()->len, ++id);
+            for (size_t i = 0; i + 1 < run.size(); i++) {
+                fprintf(file, "%zu\t%zu\t%zu\n", run[i]->len, run[i + 1]->ref_start - (run[i]->ref_start + run[i]->len),
+                        q_start(run[i + 1]) - (q_start(run[i]) + run[i]->len));
+            }
+            fprintf(file, "%zu\n\n", run.back()->len);
+            b = next;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+bool LiftoverIndex::add_record_column(const char* record_path) const {
+    std::string tmp_path = std::string(record_path) + ".tmp";
+    {
+        std::ifstream in(record_path);
+        std::ofstream out(tmp_path);
+        if (!in.is_open() || !out.is_open()) {
+            std::cerr << "Unable to add MUT_POS to " << record_path << std::endl;
+            return false;
+        }
+        std::string line;
+        std::vector<Position> hits;
+        while (std::getline(in, line)) {
+            if (line.compare(0, 6, "#CHROM") == 0) {
+                out << line << "\tMUT_POS\n";
+                continue;
+            }
+            if (line.empty() || line[0] == '#') {
+                out << line << '\n';
+                continue;
+            }
+            // chrom \t pos \t ...
+            size_t tab = line.find('\t');
+            long chrom = tab == std::string::npos ? -1 : ref_chrom_of(line.substr(0, tab));
+            hits.clear();
+            if (chrom >= 0) {
+                size_t pos = strtoull(line.c_str() + tab + 1, nullptr, 10);
+                if (pos < reference_[chrom]->size()) {
+                    ref_to_mut(chrom, pos, hits);
+                }
+            }
+            out << line << '\t';
+            if (hits.empty()) {
+                out << '.';
+            }
+            for (size_t i = 0; i < hits.size(); i++) {
+                out << (i == 0 ? "" : ",") << mut_names_[hits[i].chrom] << ':' << hits[i].pos;
+            }
+            out << '\n';
+        }
+    }
+    return rename(tmp_path.c_str(), record_path) == 0;
+}
@@ -0,0 +1,116 @@
+#ifndef LIFTOVER_H
+#define LIFTOVER_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "io.h"
+#include "linkedSequence.h"
+
+/*
+    Coordinate index between the reference and a mutated genome, built from the finished LS chains
+    every non-empty LS is one block: a run of mutated positions that came from a run of reference positions
+    (reversed for an inverted LS) or from inserted bases with no reference position at all,
+    LS that continue each other in the reference are merged into one block
+
+    mut -> ref is a binary search over the blocks of the mutated chromosome, O(log n)
+    ref -> mut is a binary search over the reference cut into intervals where the same blocks cover every base,
+    O(log n + k) for k copies,
+    a reference base can have no mutated position (deleted) or several (CNV amplification)
+
+    positions are 0-based like the mutation record, chromosomes are indices: reference chromosome i is
+    the i-th Sequence given to the constructor, mutated chromosome i is the i-th chain given to add_chain
+*/
+class LiftoverIndex {
+    public:
+        struct Position {
+            size_t chrom;
+            size_t pos;
+            // the base is the reverse complement of the one at the other side
+            bool reversed;
+        };
+
+        explicit LiftoverIndex(const std::vector<Sequence*>& reference);
+
+        /*
+            add the chain of the next mutated chromosome, call in chromosome order then finish() once
+        */
+        void add_chain(const LinkedSequence* head);
+
+        // sort the reference side, no add_chain after this
+        void finish();
+
+        /*
+            reference position of base mut_pos of mutated chromosome mut_chrom
+            return false if that base was inserted and has none
+        */
+        bool mut_to_ref(size_t mut_chrom, size_t mut_pos, Position& out) const;
+
+        /*
+            every mutated position of base ref_pos of reference chromosome ref_chrom, in (chrom, pos) order
+            out is empty if the base was deleted
+        */
+        void ref_to_mut(size_t ref_chrom, size_t ref_pos, std::vector<Position>& out) const;
+
+        /*
+            index of the reference chromosome with the full header id, -1 if there is none
+        */
+        long ref_chrom_of(const std::string& id) const;
+
+        /*
+            write the mapping as a UCSC chain file, reference as target and mutated genome as query
+            one chain per run of blocks that goes forward in both (query on the - strand for inverted runs)
+        */
+        bool write_chain(const char* path) const;
+
+        /*
+            rewrite the mutation record at record_path with a MUT_POS column: every mutated position of the
+            record's reference base as name:pos (comma separated for several copies), "." if there is none
+        */
+        bool add_record_column(const char* record_path) const;
+
+        // blocks over all mutated chromosomes
+        size_t block_count() const;
+
+    private:
+        static constexpr uint32_t NO_REF = static_cast<uint32_t>(-1);
+
+        struct Block {
+            size_t mut_start;
+            size_t ref_start;
+            size_t len;
+            uint32_t ref_chrom;
+            bool reversed;
+        };
+
+        // a block with a reference position
+        struct RefCover {
+            uint32_t mut_chrom;
+            uint32_t block;
+        };
+
+        /*
+            reference side of one reference chromosome: non-overlapping intervals sorted by start, interval i
+            goes from starts[i] to starts[i + 1] and every one of its bases is covered by
+            covers[first[i]] up to covers[first[i + 1]], the last start closes the last interval
+            add_chain collects the blocks in covers, finish() cuts the intervals
+        */
+        struct RefSide {
+            std::vector<size_t> starts;
+            std::vector<size_t> first;
+            std::vector<RefCover> covers;
+        };
+
+        std::vector<const Sequence*> reference_;
+        std::unordered_map<const Sequence*, uint32_t> ref_index_;
+        std::unordered_map<std::string, uint32_t> ref_names_;
+        // name (first word of the header) and length of every mutated chromosome
+        std::vector<std::string> mut_names_;
+        std::vector<size_t> mut_sizes_;
+        std::vector<std::vector<Block>> blocks_;
+        std::vector<RefSide> by_ref_;
+};
+
+#endif // LIFTOVER_H
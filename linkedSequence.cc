@@ -1,36 +1,32 @@
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <memory>
 #include <sstream>
 #include <vector>
 
 #include "linkedSequence.h"
+#include "snpOverlay.h"
 /*----------Class member functions----------*/
 // ctor
-LinkedSequence::LinkedSequence(Sequence* seq, const size_t start, const size_t end, LinkedSequence* next)
-    : seq_(seq), start_(start), end_(end), next_(next) {
-    assert((start <= seq->data->size()-1 && end <= seq->data->size()-1) && "Invalid start and/or end value");
+LinkedSequence::LinkedSequence(Sequence* seq, const size_t start, const size_t end, LinkedSequence* next,
+                               SegmentPool* pool, bool reversed)
+    : seq_(seq), start_(start), end_(end), next_(next), pool_(pool), reversed_(reversed) {
+    assert((start <= seq->size()-1 && end <= seq->size()-1) && "Invalid start and/or end value");
 }
 
-LinkedSequence::LinkedSequence(Sequence* seq) 
-    : seq_(seq), start_(0), end_(seq->data->size()-1), next_(nullptr){}
+LinkedSequence::LinkedSequence(Sequence* seq, SegmentPool* pool)
+    : seq_(seq), start_(0), end_(seq->size()-1), next_(nullptr), pool_(pool), reversed_(false) {}
 
 // cctor
 LinkedSequence::LinkedSequence(const LinkedSequence& ls)
-    : seq_(ls.seq_), start_(ls.start_), end_(ls.end_), next_(ls.next_) {
+    : seq_(ls.seq_), start_(ls.start_), end_(ls.end_), next_(ls.next_), pool_(ls.pool_), reversed_(ls.reversed_) {
     // Note: shallow copy 
 }
 
-// dtor
-LinkedSequence::~LinkedSequence(){
-    if (seq_->id.empty()) {
-        delete seq_;
-    }
-    delete next_;
-}
-
 // assignment
 LinkedSequence& LinkedSequence::operator=(const LinkedSequence& ls) {
     if (this != &ls) {
@@ -38,6 +34,8 @@ LinkedSequence& LinkedSequence::operator=(const LinkedSequence& ls) {
         start_ = ls.start_;
         end_ = ls.end_;
         next_ = ls.next_;
+        pool_ = ls.pool_;
+        reversed_ = ls.reversed_;
     }
     return *this;
 }
@@ -58,15 +56,22 @@ bool LinkedSequence::contain_cycle() const {
 LinkedSequence* LinkedSequence::split(size_t new_start) {
     assert(valid_pos(new_start) && "Invalid input: start <= new_start <= end");
 
-    if (start_ == new_start) {
+    if (front() == new_start) {
         // already split, nothing to do
         return this;
     }
     // call copy constructor
-    LinkedSequence* newls = new LinkedSequence(*this);
+    LinkedSequence* newls = pool_->make(*this);
+    STAT_ADD(STAT_SPLITS, 1);
 
-    end_ = new_start-1;
-    newls->start_ = new_start;
+    if (reversed_) {
+        // visible order runs from end to start
+        start_ = new_start+1;
+        newls->end_ = new_start;
+    } else {
+        end_ = new_start-1;
+        newls->start_ = new_start;
+    }
 
     newls->next_ = next_;
     next_ = newls;
@@ -76,13 +81,26 @@ LinkedSequence* LinkedSequence::split(size_t new_start) {
 
 LinkedSequence* LinkedSequence::insert_seq(Sequence* seq, size_t insert_pos) {
     assert(valid_pos(insert_pos) && "Invalid input: start <= insert_pos <= end");
-    LinkedSequence* newls = new LinkedSequence(seq);
+    return link_before(pool_->make(pool_->adopt(seq), pool_), insert_pos);
+}
+
+LinkedSequence* LinkedSequence::insert_bases(const char* bases, size_t n, size_t insert_pos) {
+    assert(valid_pos(insert_pos) && "Invalid input: start <= insert_pos <= end");
+    assert(n > 0 && "Nothing to insert");
+    Sequence* insertions = pool_->append_insertion(bases, n, seq_->is_packed());
+    size_t end = insertions->size() - 1;
+    return link_before(pool_->make(insertions, end + 1 - n, end, nullptr, pool_), insert_pos);
+}
+
+LinkedSequence* LinkedSequence::link_before(LinkedSequence* newls, size_t insert_pos) {
+    STAT_ADD(STAT_INSERTS, 1);
+    STAT_ADD(STAT_BASES_INSERTED, newls->size());
     LinkedSequence* nextls = split(insert_pos);
 
-    if (insert_pos == this->start_) {
+    if (insert_pos == front()) {
         // meaning split did not create a new LS
         assert(nextls == this);
-        LinkedSequence* copyls = new LinkedSequence(*this);
+        LinkedSequence* copyls = pool_->make(*this);
         copyls->next_ = next_;
         // mark current ls as empty
         start_ = end_ + 1;
@@ -98,37 +116,139 @@ LinkedSequence* LinkedSequence::insert_seq(Sequence* seq, size_t insert_pos) {
 
 LinkedSequence* LinkedSequence::delete_section(size_t delete_start, size_t size) {
     assert(valid_pos(delete_start) && "Invalid input: start <= delete_start <= end");
+    STAT_ADD(STAT_DELETES, 1);
 
     LinkedSequence* nextls = split(delete_start);
-    
-    if (delete_start + size > nextls->end_) {
+
+    // walk forward instead of recursing, a long deletion can cover many LS
+    // the walk stops on the LS holding the last deleted base once no size is left, so a deletion cut short
+    // at a chunk boundary never reads or writes the next chunk's first LS (another worker may be mutating it)
+    while (size > nextls->size()) {
+        size -= nextls->size();
         // nextls is fully deleted, mark it as empty
-        nextls->start_ = nextls->end_ + 1;
+        nextls->drop_front(nextls->size());
         assert(nextls->is_empty() && "Nextls isn't empty");
 
-        size_t over = delete_start + size - nextls->end_ - 1;  // -1 because end is inclusive
-        LinkedSequence* nnext = nextls->next_;
-        if (nnext == nullptr) {
+        nextls = nextls->next_;
+        if (nextls == nullptr) {
             return nullptr;
         }
-        return nnext->delete_section(nnext->start_, over);
     }
-    // effectively skip over the (delete_start,delete_start+size-1) segment
-    nextls->start_ = delete_start + size;
+    // effectively skip over the deleted bases at the visible front
+    nextls->drop_front(size);
     return nextls;
 }
 
-void LinkedSequence::reverse() {
-    // reference binding, do NOT copy sequence
-    Sequence* seq = seq_;
-    size_t left = start_;
-    size_t right = end_;
-    while (left < right) {
-        // Swap characters at left and right indices
-        std::swap(seq->data[left], seq->data[right]);
-        left++;
-        right--;
+std::vector<LinkedSequence*> LinkedSequence::split_chunks(size_t chunk_bases) {
+    std::vector<LinkedSequence*> chunks = {this};
+    if (chunk_bases == 0) {
+        return chunks;
     }
+    SegmentPool* chunk_pool = pool_;
+    size_t filled = 0;  // visible bases in the current chunk so far
+    LinkedSequence* ls = this;
+    while (ls != nullptr) {
+        if (filled == chunk_bases && ls->is_empty() == false) {
+            // current chunk is full, start the next one at ls
+            chunk_pool = pool_->spawn();
+            chunks.push_back(ls);
+            filled = 0;
+        }
+        ls->pool_ = chunk_pool;
+        size_t take = ls->size();
+        if (filled + take > chunk_bases) {
+            // chunk boundary falls inside ls, the new LS is picked up on the next iteration
+            take = chunk_bases - filled;
+            ls->split(ls->seq_pos(take));
+        }
+        filled += take;
+        ls = ls->next_;
+    }
+    return chunks;
+}
+
+LinkedSequence* LinkedSequence::cut_after(size_t offset) {
+    if (offset == 0 && is_empty() == false) {
+        // same as insert_seq at start_, move the bases to a copy and keep "this" as an empty LS
+        LinkedSequence* copyls = pool_->make(*this);
+        copyls->next_ = next_;
+        start_ = end_ + 1;
+        next_ = copyls;
+        return this;
+    }
+    LinkedSequence* ls = this;
+    // the LS holding base offset-1, skipping empty LS at the boundary is fine either way
+    while (offset > ls->size()) {
+        offset -= ls->size();
+        ls = ls->next_;
+        assert(ls != nullptr && "offset past the end of the chain");
+    }
+    if (offset > 0 && offset < ls->size()) {
+        ls->split(ls->seq_pos(offset));
+    }
+    return ls;
+}
+
+void LinkedSequence::copy_visible(size_t offset, size_t n, char* out, const SnpOverlay* snps) const {
+    size_t first = reversed_ ? end_ - offset - n + 1 : start_ + offset;
+    seq_->copy_bases(first, n, out);
+    if (snps != nullptr) {
+        snps->apply(seq_, first, n, out);
+    }
+    if (reversed_) {
+        reverse_complement(out, n);
+    }
+}
+
+size_t LinkedSequence::copy_range(size_t offset, size_t n, char* out, const SnpOverlay* snps) const {
+    size_t copied = 0;
+    for (const LinkedSequence* ls = this; ls != nullptr && copied < n; ls = ls->next_) {
+        if (offset >= ls->size()) {
+            offset -= ls->size();  // range starts further down the chain, empty LS are skipped here too
+            continue;
+        }
+        size_t take = std::min(n - copied, ls->size() - offset);
+        ls->copy_visible(offset, take, out + copied, snps);
+        copied += take;
+        offset = 0;
+    }
+    return copied;
+}
+
+bool SpanIterator::next(BaseSpan& span) {
+    while (ls_ != nullptr && offset_ >= ls_->size()) {
+        offset_ -= ls_->size();
+        ls_ = ls_->get_next();
+    }
+    if (ls_ == nullptr || left_ == 0) {
+        return false;
+    }
+    size_t take = std::min(left_, ls_->size() - offset_);
+    span.seq = ls_->get_seq();
+    // lowest Sequence position of the piece, its visible front unless reversed
+    span.pos = ls_->is_reversed() ? ls_->seq_pos(offset_ + take - 1) : ls_->seq_pos(offset_);
+    span.len = take;
+    span.reversed = ls_->is_reversed();
+    span.bases = span.seq->plain_bases(span.pos);
+    left_ -= take;
+    offset_ = 0;
+    ls_ = ls_->get_next();
+    return true;
+}
+
+LinkedSequence* LinkedSequence::clone_all(SegmentPool* pool) const {
+    LinkedSequence* head = pool->make(*this);
+    head->pool_ = pool;
+    LinkedSequence* tail = head;
+    for (const LinkedSequence* ls = next_; ls != nullptr; ls = ls->next_) {
+        if (ls->is_empty() == false) {
+            tail->next_ = pool->make(*ls);
+            tail = tail->next_;
+            tail->pool_ = pool;
+        }
+    }
+    tail->next_ = nullptr;
+    return head;
 }
 
 std::string LinkedSequence::to_string_all(bool debug) const {
@@ -147,33 +267,125 @@ std::string LinkedSequence::to_string_all(bool debug) const {
     return std::move(oss.str());
 }
 
+void LinkedSequence::write_all(FastaWriter& out, bool debug, const SnpOverlay* snps) const {
+    const LinkedSequence* runner = this;
+    assert(contain_cycle() == false && "LinkedSequence contains cycle");
+    // consecutive LS mostly move forward in one Sequence, the cursor picks up the snps where the last LS left off
+    std::unique_ptr<SnpOverlay::Cursor> cursor(snps != nullptr ? new SnpOverlay::Cursor(*snps) : nullptr);
+    while (runner != nullptr) {
+        if (runner->is_empty() == false) {
+            const char* plain = runner->seq_->plain_bases(runner->start_);
+            bool patched = cursor != nullptr && cursor->touches(runner->seq_, runner->start_, runner->size());
+            if (plain != nullptr && runner->reversed_ == false && patched == false) {
+                // slice straight out of the Sequence, no copy besides the output buffer
+                out.write_bases(plain, runner->size());
+            } else {
+                // packed, reversed or with snps, unpack / patch / reverse complement through a small buffer
+                char unpacked[1 << 16];
+                for (size_t done = 0; done < runner->size(); done += sizeof(unpacked)) {
+                    size_t n = std::min(sizeof(unpacked), runner->size() - done);
+                    size_t first = runner->reversed_ ? runner->end_ - done - n + 1 : runner->start_ + done;
+                    runner->seq_->copy_bases(first, n, unpacked);
+                    if (patched) {
+                        cursor->apply(runner->seq_, first, n, unpacked);
+                    }
+                    if (runner->reversed_) {
+                        reverse_complement(unpacked, n);
+                    }
+                    out.write_bases(unpacked, n);
+                }
+            }
+            if (debug) {
+                out.write_raw("->", 2);
+            }
+        }
+        runner = runner->next_;
+    }
+}
+
+/*----------SegmentPool----------*/
+SegmentPool::~SegmentPool() {
+    for (SegmentPool* child : children_) {
+        delete child;
+    }
+    for (LinkedSequence* block : blocks_) {
+        ::operator delete(block);
+    }
+    for (Sequence* seq : owned_) {
+        delete seq;
+    }
+}
+
+Sequence* SegmentPool::append_insertion(const char* bases, size_t n, bool packed) {
+    if (insertions_ == nullptr) {
+        insertions_ = packed ? adopt(new Sequence(std::string(), new PackedBases()))
+                             : adopt(new Sequence(std::string(), new std::string()));
+    }
+    assert(insertions_->is_packed() == packed && "Insertions of one pool must all be packed or all plain");
+    if (packed) {
+        // write 2 bit codes directly, never going through chars
+        for (size_t i = 0; i < n; i++) {
+            insertions_->packed->push_code(PackedBases::base_code(bases[i]));
+        }
+    } else {
+        insertions_->data->append(bases, n);
+    }
+    return insertions_;
+}
+
 /*----------Functions that uses the class----------*/
 
 std::vector<LinkedSequence*> init_vector_LinkedSequence(std::vector<Sequence*>& sequences) {
     std::vector<LinkedSequence*> linkedseqs;
     for (Sequence* seq : sequences) {
-        linkedseqs.push_back(new LinkedSequence(seq));
+        SegmentPool* pool = new SegmentPool();
+        linkedseqs.push_back(pool->make(seq, pool));
     }
     return linkedseqs;
 }
 
-void write_mutated_ref(const char *ref_path, std::vector<LinkedSequence*>& linkedseqs) {
-    // create mut_ ref filename
+void free_linkedseqs(std::vector<LinkedSequence*>& linkedseqs) {
+    for (LinkedSequence* ls : linkedseqs) {
+        delete ls->get_pool();
+    }
+    linkedseqs.clear();
+}
+
+std::vector<LinkedSequence*> clone_linkedseqs(const std::vector<LinkedSequence*>& linkedseqs) {
+    std::vector<LinkedSequence*> clones;
+    for (const LinkedSequence* head : linkedseqs) {
+        clones.push_back(head->clone_all(new SegmentPool()));
+    }
+    return clones;
+}
+
+std::string mutated_filename(const char* ref_path, const std::string& tag) {
     std::string original(ref_path);
+    // drop the directory, a "." in it is not the extension either
+    size_t slash_pos = original.rfind('/');
+    if (slash_pos != std::string::npos) {
+        original = original.substr(slash_pos + 1);
+    }
     size_t dot_pos = original.rfind('.');
-    //                           mut_ prefix    filename      everything after ".", should just be fa
-    std::string mutated_filename = "mut_" + original.substr(0, dot_pos) + original.substr(dot_pos);
+    if (dot_pos == std::string::npos) {
+        dot_pos = original.size();
+    }
+    std::string suffix = tag.empty() ? std::string() : "_" + tag;
+    //     mut_ prefix    filename                     tag      everything after ".", should just be fa
+    return "mut_" + original.substr(0, dot_pos) + suffix + original.substr(dot_pos);
+}
 
-    std::ofstream mut_file(mutated_filename);
+void write_mutated_ref(const char *ref_path, std::vector<LinkedSequence*>& linkedseqs,
+                       size_t line_width, bool debug, const std::string& tag, const SnpOverlay* snps,
+                       size_t bgzf_threads) {
+    std::string path = mutated_filename(ref_path, tag) + (bgzf_threads > 0 ? ".gz" : "");
+    FastaWriter mut_file(path.c_str(), line_width, 1 << 22, bgzf_threads);
     if (mut_file.is_open()) {
         for (LinkedSequence* ls : linkedseqs) {
             // write id
-            mut_file << ls->get_seq_id() << std::endl;
-            // write data, to_string_all(true) to include "->"
-            mut_file << ls->to_string_all(true) << std::endl; 
+            mut_file.write_header(ls->get_seq_id());
+            // stream data segment by segment, debug to include "->"
+            ls->write_all(mut_file, debug, snps);
         }
-        mut_file.close();
-    } else {
-        std::cerr << "Unable to open mutated output file" << std::endl;
     }
-}
\ No newline at end of file
+}
@@ -1,12 +1,40 @@
 #ifndef LINKEDSEQUENCE
 #define LINKEDSEQUENCE
 
+#include <cassert>
+#include <new>
+#include <type_traits>
+#include <utility>
+
 #include "io.h"
+#include "stats.h"
+
+class SegmentPool;
+class SnpOverlay;
+
+/*
+    One piece of a range of a chain, the part of it inside one LS, pointing into that LS's Sequence
+    the visible bases are [pos, pos + len) of seq, reverse complemented if reversed
+    bases points at seq position pos if seq holds plain chars, nullptr if it is packed
+*/
+struct BaseSpan {
+    Sequence* seq;
+    size_t pos;
+    size_t len;
+    bool reversed;
+    const char* bases;
+};
 
 /*
     Class representing an LinkedSequence object, who points to a Sequence on the stack
     a start and end position of that Sequence (inclusive), and a .next pointer to another LinkedSequence
 
+    a reversed LS shows the reverse complement of its bases, its visible front is end and
+    its visible back is start, positions passed to the API are still Sequence positions
+
+    every LS lives in a SegmentPool, new LS created by split/insert_seq/delete_section come from
+    the same pool, so they must be created through SegmentPool::make and never deleted one by one
+
     for simplicity, the class will often be refered to as LS instead
 */
 class LinkedSequence {
@@ -14,11 +42,12 @@ class LinkedSequence {
         /* 
             Construct LS with all object field specified
         */
-        LinkedSequence(Sequence* seq, const size_t start, const size_t end, LinkedSequence* next);
+        LinkedSequence(Sequence* seq, const size_t start, const size_t end, LinkedSequence* next, SegmentPool* pool,
+                       bool reversed = false);
         /*
             Construct LS with just Sequence
         */
-        LinkedSequence(Sequence* seq);
+        LinkedSequence(Sequence* seq, SegmentPool* pool);
 
         /*
             Copy constructor for LS
@@ -27,11 +56,10 @@ class LinkedSequence {
 
         /*
             Destructor
-            Only delete Sequence if LS owns the Sequence (ex. created via inserts)
-            Created Sequence have nullptr for Sequence.id
-            Recursively delete LS that follows after next_
+            Nothing to do, the SegmentPool owns every LS and every inserted Sequence
+            and releases them in bulk
         */
-        ~LinkedSequence();
+        ~LinkedSequence() = default;
 
         /*
             Assignment Operator
@@ -59,6 +87,8 @@ class LinkedSequence {
             before: prev LS -> this LS(start,end) -> next LS
             after:  prev LS -> this LS(start, nextStart-1) -> new LS(nextStart,end) -> next LS
             return the LS with new nextStart------------------^
+            if reversed, new_start is the visible front of the new LS instead
+            after:  prev LS -> this LS(nextStart+1, end) -> new LS(start, nextStart) -> next LS
 
             be VERY careful, as mishandling pointers can cause data to be lost and not freed at program exit
             or causing cycles in LS
@@ -69,10 +99,19 @@ class LinkedSequence {
             Insert given LS at insert_pos of "this"
             before: prev LS -> this LS (start, end) -> next LS
             after:  prev LS -> this LS (start, pos-1) -> new LS (pos, end) -> next LS 
+            the pool of "this" takes ownership of seq
             return LS after insertion
         */
         LinkedSequence* insert_seq(Sequence* seq, size_t insert_pos);
 
+        /*
+            Insert the n bases at bases at insert_pos of "this", links like insert_seq
+            the bases are appended to the insertion Sequence of the pool (SegmentPool::append_insertion)
+            and the new LS points into it, so no Sequence is made per insertion
+            return LS after insertion
+        */
+        LinkedSequence* insert_bases(const char* bases, size_t n, size_t insert_pos);
+
         /*
             "Delete" size bases starting at delete_start
                 before: (start -> end)
@@ -81,14 +120,44 @@ class LinkedSequence {
                 if delete_start + size > end, delete remaining from future LinkedSequence, 
                 until reach end
             Note: no actual data is deleted, just won't be visible to any LinkedSequence
-            return the LS after the deleted segment
+            return the LS the deletion ends in, its visible front is the base after the deleted segment
+            (empty if the deletion reached its end), no LS after it is read or written
         */
         LinkedSequence* delete_section(size_t delete_start, size_t size);
 
         /*
-            reverse the data in Sequence in-place
+            split the chain from "this" to the end into chunks of chunk_bases visible bases
+            (the last one may be shorter), return the first LS of every chunk, starting with "this"
+            every chunk after the first gets its own child SegmentPool, so different chunks
+            can be mutated concurrently as long as nothing crosses into the next chunk
         */
-        void reverse();
+        std::vector<LinkedSequence*> split_chunks(size_t chunk_bases);
+
+        /*
+            reverse complement "this" in O(1) by flipping its orientation
+            the data in Sequence is never touched, other LS may point at the same bases
+            the order of LS within a chain is up to the caller
+        */
+        void reverse() {
+            reversed_ = !reversed_;
+        }
+
+        /*
+            make sure a LS ends right after the first offset visible bases of the chain starting at "this"
+            splitting one if needed, and return that LS, so a section can be unlinked right after it
+            offset == 0 returns "this" after moving its bases to a new LS (like insert_seq at start_)
+            the returned LS keeps ending at offset as long as later cuts are at larger offsets
+            walks next_, O(LS before offset)
+        */
+        LinkedSequence* cut_after(size_t offset);
+
+        /*
+            relink "this" to next, the caller is responsible for keeping every LS reachable
+            exactly once and not creating cycles
+        */
+        void set_next(LinkedSequence* next) {
+            next_ = next;
+        }
 
         /*
             return the string representation all the way to end
@@ -96,6 +165,19 @@ class LinkedSequence {
         */
         std::string to_string_all(bool debug = false) const;
 
+        /*
+            stream every segment all the way to end into out, no intermediate string is built
+            debug = true sets "->" delimiters between different LS
+            snps (if given) are patched in on the way out
+        */
+        void write_all(FastaWriter& out, bool debug = false, const SnpOverlay* snps = nullptr) const;
+
+        /*
+            copy "this" and every non empty LS after it into pool, return the new head
+            the copies point at the same Sequence, so a haplotype costs one LS per segment
+        */
+        LinkedSequence* clone_all(SegmentPool* pool) const;
+
         // return if the pos is valid within the context of this LS
         // notice it must be valid to THIS ls, not just valid to the sequence
         bool valid_pos(size_t pos) const {
@@ -110,6 +192,39 @@ class LinkedSequence {
             return end_;
         }
 
+        bool is_reversed() const {
+            return reversed_;
+        }
+
+        // Sequence position of the visible first base
+        size_t front() const {
+            return reversed_ ? end_ : start_;
+        }
+
+        // Sequence position of the base offset bases after the visible front
+        size_t seq_pos(size_t offset) const {
+            return reversed_ ? end_ - offset : start_ + offset;
+        }
+
+        // number of visible bases in front of Sequence position pos
+        size_t offset_of(size_t pos) const {
+            return reversed_ ? end_ - pos : pos - start_;
+        }
+
+        /*
+            copy n visible bases starting offset bases after the visible front into out
+            reverse complemented if reversed, snps (if given) are patched in first
+        */
+        void copy_visible(size_t offset, size_t n, char* out, const SnpOverlay* snps = nullptr) const;
+
+        /*
+            copy n visible bases of the chain starting offset bases after the visible front of "this"
+            into out, moving on to the next LS as needed (offset may be past "this")
+            one slice per LS (a memcpy for a plain LS), like copy_visible for each of them
+            return the number of bases copied, less than n only if the chain ends first
+        */
+        size_t copy_range(size_t offset, size_t n, char* out, const SnpOverlay* snps = nullptr) const;
+
         // be careful of calling non const method on this pointer
         // mainly should be used to advances a local LS*
         // ex. LS* ls = ls.get_next()
@@ -117,14 +232,25 @@ class LinkedSequence {
             return next_;
         }
 
-        std::string get_seq_at(size_t pos) const {
+        // visible base at Sequence position pos, complemented if reversed
+        char get_seq_at(size_t pos) const {
             assert(valid_pos(pos));
-            return seq_->data->substr(pos,1);
+            char base;
+            copy_visible(offset_of(pos), 1, &base);
+            return base;
         }
 
         std::string get_seq_id() const {
             return seq_->id;
         }
+
+        Sequence* get_seq() const {
+            return seq_;
+        }
+
+        SegmentPool* get_pool() const {
+            return pool_;
+        }
         
     private:
         // object fields
@@ -132,6 +258,11 @@ class LinkedSequence {
         size_t start_;
         size_t end_;
         LinkedSequence* next_;
+        SegmentPool* pool_;
+        bool reversed_;
+
+        // SegmentRope converts to and from LS chains
+        friend class SegmentRope;
 
         /*
             return true if LS contains a cycle, false if not
@@ -142,19 +273,161 @@ class LinkedSequence {
             return the string representation of this LinkedSequence
         */
         std::string to_string() const {
-            return seq_->data->substr(start_, size());
+            std::string out(size(), '\0');
+            copy_visible(0, size(), &out[0]);
+            return out;
+        }
+
+        // link newls in front of insert_pos, return LS after insertion
+        LinkedSequence* link_before(LinkedSequence* newls, size_t insert_pos);
+
+        // drop n bases from the visible front
+        void drop_front(size_t n) {
+            if (n >= size()) {
+                start_ = end_ + 1;  // mark as empty
+            } else if (reversed_) {
+                end_ -= n;
+            } else {
+                start_ += n;
+            }
         }
 };
 
 
+/*
+    Zero copy walk over the pieces of a range of a chain, one BaseSpan per LS the range touches, in order
+        SpanIterator spans(ls, offset, n);
+        BaseSpan span;
+        while (spans.next(span)) { ... }
+    the range is n visible bases starting offset bases after the visible front of ls, cut short at the
+    end of the chain, the chain must not change while walking it
+*/
+class SpanIterator {
+    public:
+        SpanIterator(const LinkedSequence* ls, size_t offset, size_t n) : ls_(ls), offset_(offset), left_(n) {}
+
+        /*
+            fill span with the next piece, return false once the range is done
+        */
+        bool next(BaseSpan& span);
+
+    private:
+        const LinkedSequence* ls_;
+        // visible offset into ls_ and bases left in the range
+        size_t offset_;
+        size_t left_;
+};
+
+/*
+    Arena owning every LS of one chromosome (or chunk) plus the Sequence created for insertions
+    LS are placement-constructed into fixed size blocks, so making one is a pointer bump,
+    and the whole chain is released at once by ~SegmentPool with no recursion over next_
+*/
+class SegmentPool {
+    public:
+        SegmentPool() : used_(BLOCK_NODES), insertions_(nullptr) {}
+
+        // release every block and every owned Sequence
+        ~SegmentPool();
+
+        SegmentPool(const SegmentPool&) = delete;
+        SegmentPool& operator=(const SegmentPool&) = delete;
+
+        /*
+            construct a new LS inside the pool, arguments are forwarded to the LS constructor
+        */
+        template <typename... Args>
+        LinkedSequence* make(Args&&... args) {
+            if (used_ == BLOCK_NODES) {
+                blocks_.push_back(static_cast<LinkedSequence*>(::operator new(sizeof(LinkedSequence) * BLOCK_NODES)));
+                used_ = 0;
+            }
+            STAT_ADD(STAT_NODES, 1);
+            return new (blocks_.back() + used_++) LinkedSequence(std::forward<Args>(args)...);
+        }
+
+        /*
+            take ownership of seq, it is deleted along with the pool
+        */
+        Sequence* adopt(Sequence* seq) {
+            owned_.push_back(seq);
+            return seq;
+        }
+
+        /*
+            append n bases (ACGT) to the insertion Sequence of the pool and return it, the new bases are its last n
+            one growable Sequence per pool holds every base inserted through it, stored plain or 2 bit packed
+            like the reference (packed must be the same on every call), LS point into it by position
+        */
+        Sequence* append_insertion(const char* bases, size_t n, bool packed);
+
+        /*
+            create a child pool that is released along with this one
+            only call while no other thread is using this pool
+        */
+        SegmentPool* spawn() {
+            children_.push_back(new SegmentPool());
+            return children_.back();
+        }
+
+        // number of LS made so far, including child pools
+        size_t node_count() const {
+            size_t count = blocks_.empty() ? 0 : (blocks_.size() - 1) * BLOCK_NODES + used_;
+            for (const SegmentPool* child : children_) {
+                count += child->node_count();
+            }
+            return count;
+        }
+
+    private:
+        static constexpr size_t BLOCK_NODES = 4096;
+        // LS are never destroyed one at a time, so they can't hold anything that needs a dtor
+        static_assert(std::is_trivially_destructible<LinkedSequence>::value, "LS must be trivially destructible");
+
+        std::vector<LinkedSequence*> blocks_;
+        size_t used_;
+        std::vector<Sequence*> owned_;
+        // made on the first append_insertion, owned_ holds it too
+        Sequence* insertions_;
+        std::vector<SegmentPool*> children_;
+};
+
 /*
     Create a vector<LinkedSequence*> stored on the stack using the read in data of vector<Sequence*>
+    each head gets its own SegmentPool, free with free_linkedseqs
 */
 std::vector<LinkedSequence*> init_vector_LinkedSequence(std::vector<Sequence*>& sequences);
 
 /*
-    Write output FA using the heads of each LinkedSequence
+    Free every chain created by init_vector_LinkedSequence, one bulk release per SegmentPool
+*/
+void free_linkedseqs(std::vector<LinkedSequence*>& linkedseqs);
+
+/*
+    Copy every chain with LinkedSequence::clone_all, the bases are shared with linkedseqs
+    each new head gets its own SegmentPool, free with free_linkedseqs
+    linkedseqs (and the Sequence its pools own) must outlive the copies
+*/
+std::vector<LinkedSequence*> clone_linkedseqs(const std::vector<LinkedSequence*>& linkedseqs);
+
+/*
+    return the mutated FA name of ref_path, "mut_" in front and "_<tag>" before the extension if given
+    ex. ref.fa -> mut_ref.fa, or mut_ref_S1.fa with tag "S1"
+    only the file name is kept, outputs go to the current directory like the mutation record
+    ex. data/ref.fa -> mut_ref.fa
+*/
+std::string mutated_filename(const char* ref_path, const std::string& tag = std::string());
+
+/*
+    Write output FA using the heads of each LinkedSequence, named by mutated_filename(ref_path, tag)
+    sequence lines are wrapped every line_width bases (0 for one line per record)
+    debug = true sets "->" delimiters between different LS
+    snps (if given) are written in place of the reference bases
+    bgzf_threads > 0 writes <name>.gz BGZF compressed on that many threads, with its .fai and .gzi
 */
-void write_mutated_ref(const char *ref_path, std::vector<LinkedSequence*>& linkedseqs);
+void write_mutated_ref(const char *ref_path, std::vector<LinkedSequence*>& linkedseqs,
+                       size_t line_width = 60, bool debug = false,
+                       const std::string& tag = std::string(), const SnpOverlay* snps = nullptr,
+                       size_t bgzf_threads = 0);
 
 #endif // LINKEDSEQUENCE
\ No newline at end of file
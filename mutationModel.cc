@@ -0,0 +1,175 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "mutationModel.h"
+
+MutationModel default_model() {
+    MutationModel model;
+    // set avg mutation rate, this determines the probability of each mutation
+    // SV span kb to Mb, rarer still than CNV
+    // mostly inversions and translocations within a chromosome, 1 kb to 5 Mb
+    model.sv.rate = 2e-7;
+    model.sv.inv_weight = 0.4;
+    model.sv.intra_weight = 0.3;
+    model.sv.inter_weight = 0.1;
+    model.sv.bal_weight = 0.2;
+    model.sv.min_len = 1000;
+    model.sv.max_len = 5000000;
+    model.sv.max_fragments = 5;
+    // CNV are 1 kb to Mb long, so far fewer of them start per base
+    // half amplifications, half deletions, 1 kb to 5 Mb, copy number 2 to 6 for amplifications
+    model.cnv.rate = 1e-6;
+    model.cnv.amp_prob = 0.5;
+    model.cnv.min_len = 1000;
+    model.cnv.max_len = 5000000;
+    model.cnv.copy_prob = {0.0, 0.0, 8, 4, 2, 1, 1};
+    // indel probability, does NOT need to sum to 1
+    model.ins_prob = {0.0, 20,19,18,17,16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1};
+    model.del_prob = {0.0, 20,19,18,17,16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1};
+    // random base insertion
+    model.ins_base_prob = {0.25, 0.25, 0.25, 0.25};
+    model.indel_rate = 0.01;
+    // snp probabilities
+    model.snp_prob.assign(4, std::vector<double>(4, 1.0));
+    for (size_t i = 0; i < 4; i++) {
+        model.snp_prob[i][i] = 0.0;  // can't mut to itself
+    }
+    model.snp_rate = 0.02;
+    return model;
+}
+
+/*
+    return true if weights is usable for an AliasTable: not empty, no negative weight, some weight > 0
+*/
+static bool valid_weights(const std::vector<double>& weights) {
+    double total = 0.0;
+    for (double w : weights) {
+        if (w < 0.0) {
+            return false;
+        }
+        total += w;
+    }
+    return total > 0.0;
+}
+
+static bool valid_rate(double rate) {
+    return rate >= 0.0 && rate <= 1.0;
+}
+
+/*
+    check everything load_model could have set, print what is wrong
+*/
+static bool validate_model(const MutationModel& model, const char* path) {
+    const char* error = nullptr;
+    if (!valid_rate(model.snp_rate) || !valid_rate(model.indel_rate) ||
+        !valid_rate(model.cnv.rate) || !valid_rate(model.sv.rate) || !valid_rate(model.cnv.amp_prob)) {
+        error = "rates must be in [0, 1]";
+    } else if (!valid_weights(model.ins_prob) || model.ins_prob[0] != 0.0 ||
+               !valid_weights(model.del_prob) || model.del_prob[0] != 0.0) {
+        error = "ins_len/del_len need a weight > 0 and 0 for length 0";
+    } else if (model.ins_base_prob.size() != 4 || !valid_weights(model.ins_base_prob)) {
+        error = "ins_base needs 4 weights";
+    } else if (model.cnv.copy_prob.size() < 3 || !valid_weights(model.cnv.copy_prob) ||
+               model.cnv.copy_prob[0] != 0.0 || model.cnv.copy_prob[1] != 0.0) {
+        error = "cnv_copy needs a weight > 0 and 0 for copy number 0 and 1";
+    } else if (!valid_weights({model.sv.inv_weight, model.sv.intra_weight, model.sv.inter_weight,
+                               model.sv.bal_weight})) {
+        error = "sv_weights needs 4 weights";
+    } else if (model.cnv.min_len == 0 || model.cnv.min_len > model.cnv.max_len ||
+               model.sv.min_len == 0 || model.sv.min_len > model.sv.max_len) {
+        error = "cnv_len/sv_len need 0 < min <= max";
+    } else if (model.sv.max_fragments < 2) {
+        error = "sv_fragments must be at least 2";
+    }
+    for (size_t i = 0; i < 4 && error == nullptr; i++) {
+        if (model.snp_prob[i].size() != 4 || !valid_weights(model.snp_prob[i]) || model.snp_prob[i][i] != 0.0) {
+            error = "each snp row needs 4 weights and 0 for the base itself";
+        }
+    }
+    if (error != nullptr) {
+        std::cerr << "Invalid model " << path << ": " << error << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool load_model(const char* path, MutationModel& model) {
+    std::ifstream model_file(path);
+    if (!model_file.is_open()) {
+        std::cerr << "Unable to open model file " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(model_file, line)) {
+        line_number++;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key)) {
+            continue;  // blank line
+        }
+        // snp takes the base before its weights
+        std::string base;
+        if (key == "snp") {
+            fields >> base;
+        }
+        std::vector<double> values;
+        double value;
+        while (fields >> value) {
+            values.push_back(value);
+        }
+        bool ok = !fields.bad() && fields.eof() && !values.empty();
+
+        if (!ok) {
+            // fall through to the error below
+        } else if (key == "snp_rate" && values.size() == 1) {
+            model.snp_rate = values[0];
+        } else if (key == "indel_rate" && values.size() == 1) {
+            model.indel_rate = values[0];
+        } else if (key == "cnv_rate" && values.size() == 1) {
+            model.cnv.rate = values[0];
+        } else if (key == "sv_rate" && values.size() == 1) {
+            model.sv.rate = values[0];
+        } else if (key == "snp" && values.size() == 4 && base.size() == 1 &&
+                   std::string("ATCG").find(base[0]) != std::string::npos) {
+            model.snp_prob[std::string("ATCG").find(base[0])] = values;
+        } else if (key == "ins_len") {
+            model.ins_prob = values;
+        } else if (key == "del_len") {
+            model.del_prob = values;
+        } else if (key == "ins_base" && values.size() == 4) {
+            model.ins_base_prob = values;
+        } else if (key == "cnv_amp_prob" && values.size() == 1) {
+            model.cnv.amp_prob = values[0];
+        } else if (key == "cnv_len" && values.size() == 2) {
+            model.cnv.min_len = static_cast<size_t>(values[0]);
+            model.cnv.max_len = static_cast<size_t>(values[1]);
+        } else if (key == "cnv_copy") {
+            model.cnv.copy_prob = values;
+        } else if (key == "sv_weights" && values.size() == 4) {
+            model.sv.inv_weight = values[0];
+            model.sv.intra_weight = values[1];
+            model.sv.inter_weight = values[2];
+            model.sv.bal_weight = values[3];
+        } else if (key == "sv_len" && values.size() == 2) {
+            model.sv.min_len = static_cast<size_t>(values[0]);
+            model.sv.max_len = static_cast<size_t>(values[1]);
+        } else if (key == "sv_fragments" && values.size() == 1) {
+            model.sv.max_fragments = static_cast<size_t>(values[0]);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "Invalid line " << line_number << " in model file " << path << ": " << line << std::endl;
+            return false;
+        }
+    }
+    return validate_model(model, path);
+}
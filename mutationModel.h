@@ -0,0 +1,49 @@
+#ifndef MUTATIONMODEL_H
+#define MUTATIONMODEL_H
+
+#include <vector>
+
+#include "utils.h"
+
+/*
+    every mutation model and rate used by the passes, rates are per base
+*/
+struct MutationModel {
+    SVModel sv;
+    CNVModel cnv;
+    // indel length weights, 0 index must be 0.0 (no point ins/del 0 base pairs)
+    std::vector<double> ins_prob;
+    std::vector<double> del_prob;
+    // weight of each inserted base, ATCG in that order
+    std::vector<double> ins_base_prob;
+    double indel_rate;
+    // snp_prob[i][j] weight of base i (ATCG) turning into base j
+    std::vector<std::vector<double>> snp_prob;
+    double snp_rate;
+};
+
+/*
+    the built in model, used for anything a model file leaves out
+*/
+MutationModel default_model();
+
+/*
+    read a model file into model, every line is a key followed by its values, # starts a comment
+
+        snp_rate 0.02                   indel_rate 0.01
+        cnv_rate 1e-6                   sv_rate 2e-7
+        snp A 0 1 1 1                   one row of snp_prob per base (A, T, C or G), weights of A T C G
+        ins_len 0 20 19 18 ...          indel length weights, starting at length 0
+        del_len 0 20 19 18 ...
+        ins_base 0.25 0.25 0.25 0.25    inserted base weights, A T C G
+        cnv_amp_prob 0.5                cnv_len 1000 5000000
+        cnv_copy 0 0 8 4 2 1 1          weight of each copy number, starting at 0
+        sv_weights 0.4 0.3 0.1 0.2      inversion, translocation, inter translocation, balanced
+        sv_len 1000 5000000             sv_fragments 5
+
+    keys not in the file keep the value already in model
+    return false (and print why) on an unreadable file, unknown key or bad values
+*/
+bool load_model(const char* path, MutationModel& model);
+
+#endif // MUTATIONMODEL_H
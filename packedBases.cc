@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "packedBases.h"
+
+/*----------SIMD kernels----------*/
+#ifdef __SSE2__
+/*
+    return true if all 16 chars at src are upper case ACGT
+*/
+static inline bool all_acgt_16(__m128i v) {
+    __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('A')),
+                                            _mm_cmpeq_epi8(v, _mm_set1_epi8('C'))),
+                               _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('G')),
+                                            _mm_cmpeq_epi8(v, _mm_set1_epi8('T'))));
+    return _mm_movemask_epi8(hit) == 0xFFFF;
+}
+
+/*
+    pack 16 chars into 4 bytes
+*/
+static inline uint32_t pack_16(__m128i v) {
+    const __m128i three = _mm_set1_epi8(3);
+    // (c >> 1) & 3 per byte, bits shifted in from the neighbouring byte are masked off
+    __m128i codes = _mm_and_si128(_mm_srli_epi16(v, 1), three);
+    // low byte of each 16 bit lane = b0 | b1 << 2
+    __m128i pairs = _mm_and_si128(_mm_or_si128(codes, _mm_srli_epi16(codes, 6)), _mm_set1_epi16(0x00FF));
+    // low byte of each 32 bit lane = b0 | b1 << 2 | b2 << 4 | b3 << 6
+    __m128i quads = _mm_and_si128(_mm_or_si128(pairs, _mm_srli_epi32(pairs, 12)), _mm_set1_epi32(0xFF));
+    __m128i packed = _mm_packus_epi16(_mm_packs_epi32(quads, quads), _mm_setzero_si128());
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(packed));
+}
+
+/*
+    turn 16 codes (0-3) into the chars ACTG
+*/
+static inline __m128i codes_to_chars(__m128i codes) {
+    // 'A' + 2 for C, + 19 for T, + 6 for G
+    __m128i base = _mm_set1_epi8('A');
+    base = _mm_add_epi8(base, _mm_and_si128(_mm_cmpeq_epi8(codes, _mm_set1_epi8(1)), _mm_set1_epi8(2)));
+    base = _mm_add_epi8(base, _mm_and_si128(_mm_cmpeq_epi8(codes, _mm_set1_epi8(2)), _mm_set1_epi8(19)));
+    base = _mm_add_epi8(base, _mm_and_si128(_mm_cmpeq_epi8(codes, _mm_set1_epi8(3)), _mm_set1_epi8(6)));
+    return base;
+}
+
+/*
+    unpack 16 bytes (64 bases) into out
+*/
+static inline void unpack_64(const uint8_t* src, char* out) {
+    const __m128i three = _mm_set1_epi8(3);
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    __m128i s0 = _mm_and_si128(v, three);
+    __m128i s1 = _mm_and_si128(_mm_srli_epi16(v, 2), three);
+    __m128i s2 = _mm_and_si128(_mm_srli_epi16(v, 4), three);
+    __m128i s3 = _mm_and_si128(_mm_srli_epi16(v, 6), three);
+    // interleave so every byte's 4 codes come out in order
+    __m128i lo01 = _mm_unpacklo_epi8(s0, s1);
+    __m128i lo23 = _mm_unpacklo_epi8(s2, s3);
+    __m128i hi01 = _mm_unpackhi_epi8(s0, s1);
+    __m128i hi23 = _mm_unpackhi_epi8(s2, s3);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), codes_to_chars(_mm_unpacklo_epi16(lo01, lo23)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), codes_to_chars(_mm_unpackhi_epi16(lo01, lo23)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 32), codes_to_chars(_mm_unpacklo_epi16(hi01, hi23)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 48), codes_to_chars(_mm_unpackhi_epi16(hi01, hi23)));
+}
+#endif
+
+/*----------Runs----------*/
+size_t PackedBases::first_run(const std::vector<Run>& runs, size_t pos) {
+    // runs are sorted and don't overlap
+    return std::upper_bound(runs.begin(), runs.end(), pos,
+                            [](size_t p, const Run& run) { return p < run.start + run.len; }) - runs.begin();
+}
+
+void PackedBases::add_to_runs(std::vector<Run>& runs, size_t pos, char base) {
+    if (!runs.empty() && runs.back().start + runs.back().len == pos && runs.back().base == base) {
+        runs.back().len++;
+    } else {
+        runs.push_back(Run{pos, 1, base});
+    }
+}
+
+/*----------Packing----------*/
+void PackedBases::append_scalar(char c) {
+    switch (c) {
+        case 'A': case 'C': case 'G': case 'T':
+            break;
+        case 'a': case 'c': case 'g': case 't':
+            add_to_runs(lower_, size_, '\0');
+            break;
+        default:
+            // stored as code 0, the run table has the real char
+            add_to_runs(exceptions_, size_, c);
+            c = 'A';
+            break;
+    }
+    push_code(base_code(c));
+}
+
+void PackedBases::append(const char* src, size_t n) {
+    bytes_.reserve((size_ + n + 3) / 4);
+    size_t i = 0;
+    // fill up the partial byte first
+    while (i < n && size_ % 4 != 0) {
+        append_scalar(src[i++]);
+    }
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (!all_acgt_16(v)) {
+            // rare, N runs or soft masking
+            for (size_t j = 0; j < 16; j++) {
+                append_scalar(src[i + j]);
+            }
+            continue;
+        }
+        uint32_t packed = pack_16(v);
+        size_t at = bytes_.size();
+        bytes_.resize(at + 4);
+        memcpy(bytes_.data() + at, &packed, 4);
+        size_ += 16;
+    }
+#endif
+    while (i < n) {
+        append_scalar(src[i++]);
+    }
+}
+
+/*----------Access----------*/
+char PackedBases::at(size_t pos) const {
+    assert(pos < size_ && "Invalid input: pos < size");
+    if (!exceptions_.empty()) {
+        size_t r = first_run(exceptions_, pos);
+        if (r < exceptions_.size() && exceptions_[r].start <= pos) {
+            return exceptions_[r].base;
+        }
+    }
+    char c = code_base((bytes_[pos / 4] >> (2 * (pos % 4))) & 3);
+    if (!lower_.empty()) {
+        size_t r = first_run(lower_, pos);
+        if (r < lower_.size() && lower_[r].start <= pos) {
+            c = static_cast<char>(tolower(c));
+        }
+    }
+    return c;
+}
+
+void PackedBases::set(size_t pos, char c) {
+    assert(pos < size_ && "Invalid input: pos < size");
+    uint8_t shift = 2 * (pos % 4);
+    uint8_t& byte = bytes_[pos / 4];
+    byte = static_cast<uint8_t>((byte & ~(3 << shift)) | (base_code(c) << shift));
+}
+
+void PackedBases::copy_to(size_t pos, size_t n, char* out) const {
+    assert(pos + n <= size_ && "Invalid input: pos + n <= size");
+    size_t i = 0;
+    // scalar until pos is on a byte boundary
+    for (; i < n && (pos + i) % 4 != 0; i++) {
+        out[i] = code_base((bytes_[(pos + i) / 4] >> (2 * ((pos + i) % 4))) & 3);
+    }
+#ifdef __SSE2__
+    for (; i + 64 <= n; i += 64) {
+        unpack_64(bytes_.data() + (pos + i) / 4, out + i);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = code_base((bytes_[(pos + i) / 4] >> (2 * ((pos + i) % 4))) & 3);
+    }
+
+    // patch in the sparse runs overlapping [pos, pos + n)
+    for (size_t r = first_run(exceptions_, pos); r < exceptions_.size() && exceptions_[r].start < pos + n; r++) {
+        size_t lo = std::max(pos, exceptions_[r].start);
+        size_t hi = std::min(pos + n, exceptions_[r].start + exceptions_[r].len);
+        memset(out + (lo - pos), exceptions_[r].base, hi - lo);
+    }
+    for (size_t r = first_run(lower_, pos); r < lower_.size() && lower_[r].start < pos + n; r++) {
+        size_t lo = std::max(pos, lower_[r].start);
+        size_t hi = std::min(pos + n, lower_[r].start + lower_[r].len);
+        for (size_t j = lo; j < hi; j++) {
+            // exceptions may sit inside a lower case run too (ex. 'n'), tolower is a no-op on those
+            out[j - pos] = static_cast<char>(tolower(out[j - pos]));
+        }
+    }
+}
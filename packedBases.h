@@ -0,0 +1,94 @@
+#ifndef PACKEDBASES_H
+#define PACKEDBASES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+    2 bit per base storage for a DNA sequence, 4 bases per byte, base i at bits 2*(i%4) of byte i/4
+    the code of a base is (c >> 1) & 3, which is A=0 C=1 T=2 G=3 for upper and lower case alike
+
+    anything that isn't ACGT/acgt (N, IUPAC codes, ...) is kept in a sparse table of runs of one char,
+    lower case (soft masked) bases are kept as runs too, both are expected to be rare or long
+    packing and unpacking use SSE2 kernels when available, with a scalar fallback
+*/
+class PackedBases {
+    public:
+        PackedBases() : size_(0) {}
+
+        size_t size() const {
+            return size_;
+        }
+
+        void reserve(size_t n) {
+            bytes_.reserve((n + 3) / 4);
+        }
+
+        /*
+            pack n chars from src onto the end
+        */
+        void append(const char* src, size_t n);
+
+        /*
+            append one base given as a 2 bit code (see base_code), never an exception
+        */
+        void push_code(uint8_t code) {
+            if (size_ % 4 == 0) {
+                bytes_.push_back(0);
+            }
+            bytes_.back() |= static_cast<uint8_t>(code << (2 * (size_ % 4)));
+            size_++;
+        }
+
+        /*
+            return the base at pos
+        */
+        char at(size_t pos) const;
+
+        /*
+            overwrite the base at pos with c, c must be one of ACGT
+            the base at pos must not be an exception (N, IUPAC)
+        */
+        void set(size_t pos, char c);
+
+        /*
+            unpack n bases starting at pos into out
+        */
+        void copy_to(size_t pos, size_t n, char* out) const;
+
+        // heap bytes used, for comparing against one char per base
+        size_t memory_bytes() const {
+            return bytes_.capacity() + (exceptions_.capacity() + lower_.capacity()) * sizeof(Run);
+        }
+
+        // 2 bit code of an ACGT/acgt char
+        static uint8_t base_code(char c) {
+            return (static_cast<uint8_t>(c) >> 1) & 3;
+        }
+
+        // upper case char of a 2 bit code
+        static char code_base(uint8_t code) {
+            return "ACTG"[code];
+        }
+
+    private:
+        // run of len bases starting at start, all equal to base (lower_ runs don't use base)
+        struct Run {
+            size_t start;
+            size_t len;
+            char base;
+        };
+
+        std::vector<uint8_t> bytes_;
+        size_t size_;
+        std::vector<Run> exceptions_;
+        std::vector<Run> lower_;
+
+        void append_scalar(char c);
+        // index of the first run in runs that ends after pos
+        static size_t first_run(const std::vector<Run>& runs, size_t pos);
+        static void add_to_runs(std::vector<Run>& runs, size_t pos, char base);
+};
+
+#endif // PACKEDBASES_H
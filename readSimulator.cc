@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "readSimulator.h"
+#include "stats.h"
+#include "utils.h"
+
+/*
+    visible offset of every non empty LS of a chain, finds the LS holding a mutated position in O(log n)
+*/
+class ChainIndex {
+    public:
+        explicit ChainIndex(const LinkedSequence* head) : size_(0) {
+            for (const LinkedSequence* ls = head; ls != nullptr; ls = ls->get_next()) {
+                if (!ls->is_empty()) {
+                    starts_.push_back(size_);
+                    segments_.push_back(ls);
+                    size_ += ls->size();
+                }
+            }
+        }
+
+        // bases of the mutated chromosome
+        size_t size() const {
+            return size_;
+        }
+
+        /*
+            copy the n mutated bases starting at pos into out, pos + n <= size()
+        */
+        void copy(size_t pos, size_t n, char* out, const SnpOverlay* snps) const {
+            size_t i = std::upper_bound(starts_.begin(), starts_.end(), pos) - starts_.begin() - 1;
+            segments_[i]->copy_range(pos - starts_[i], n, out, snps);
+        }
+
+    private:
+        std::vector<size_t> starts_;
+        std::vector<const LinkedSequence*> segments_;
+        size_t size_;
+};
+
+/*
+    upper case every base of read, a sequencer never reports the reference's soft masking
+*/
+static void unmask(std::string& read) {
+    for (char& base : read) {
+        if (base >= 'a' && base <= 'z') {
+            base -= 'a' - 'A';
+        }
+    }
+}
+
+/*
+    substitute read[i] with one of the 3 other bases with probability error[i], N and other codes are kept
+    one uniform per base, a hit also picks the new base from where it fell below error[i]
+    read is upper case (unmask)
+*/
+template <typename URNG>
+static void add_errors(std::string& read, const std::vector<double>& error, std::vector<double>& uniforms,
+                       URNG& gen) {
+    static const char BASES[] = "ACGT";
+    rng_fill_uniform(gen, uniforms.data(), read.size());
+    for (size_t i = 0; i < read.size(); i++) {
+        if (uniforms[i] > error[i]) {
+            continue;
+        }
+        const char* found = strchr(BASES, read[i]);
+        if (found == nullptr || *found == '\0') {
+            continue;
+        }
+        size_t shift = 1 + std::min<size_t>(2, static_cast<size_t>(uniforms[i] / error[i] * 3));
+        read[i] = BASES[(found - BASES + shift) % 4];
+    }
+}
+
+// one FASTQ record, "@name/mate" then bases, "+" and qualities
+static void append_fastq(std::string& out, const std::string& name, int mate, const std::string& bases,
+                         const std::string& quality) {
+    out += '@';
+    out += name;
+    out += '/';
+    out += static_cast<char>('0' + mate);
+    out += '\n';
+    out += bases;
+    out += "\n+\n";
+    out += quality;
+    out += '\n';
+}
+
+ReadSimulator::ReadSimulator(const ReadModel& model, const std::string& prefix, uint64_t seed, size_t bgzf_threads)
+    : model_(model), seed_(seed), quality_(model.read_length, '!'), error_(model.read_length),
+      file_{nullptr, nullptr}, pairs_(0) {
+    size_t last = std::max<size_t>(model_.read_length, 2) - 1;
+    for (size_t i = 0; i < model_.read_length; i++) {
+        error_[i] = model_.error_first + (model_.error_last - model_.error_first) * i / last;
+        double phred = error_[i] > 0.0 ? -10.0 * std::log10(error_[i]) : 41.0;
+        quality_[i] = static_cast<char>(33 + std::max(2.0, std::min(41.0, std::round(phred))));
+    }
+    for (int mate = 0; mate < 2; mate++) {
+        std::string path = prefix + (mate == 0 ? "_R1.fq" : "_R2.fq");
+        if (bgzf_threads > 0) {
+            bgzf_[mate].reset(new BgzfWriter((path + ".gz").c_str(), bgzf_threads));
+            if (!bgzf_[mate]->is_open()) {
+                bgzf_[mate].reset();
+            }
+        } else {
+            file_[mate] = fopen(path.c_str(), "wb");
+        }
+        if (bgzf_[mate] == nullptr && file_[mate] == nullptr) {
+            std::cerr << "Unable to open read output file " << path << std::endl;
+        }
+    }
+}
+
+ReadSimulator::~ReadSimulator() {
+    for (int mate = 0; mate < 2; mate++) {
+        if (file_[mate] != nullptr) {
+            fclose(file_[mate]);
+        }
+    }
+}
+
+void ReadSimulator::write(int mate, const std::string& text) {
+    if (bgzf_[mate] != nullptr) {
+        bgzf_[mate]->write(text.data(), text.size());
+    } else if (file_[mate] != nullptr) {
+        size_t written;
+        STAT_TIMED(STAT_WRITE_NS, written = fwrite(text.data(), 1, text.size(), file_[mate]));
+        STAT_ADD(STAT_BYTES_WRITTEN, written);
+        if (written != text.size()) {
+            std::cerr << "Unable to write read output file" << std::endl;
+        }
+    }
+}
+
+void ReadSimulator::simulate(const LinkedSequence* head, size_t chrom, ThreadPool& workers, const SnpOverlay* snps) {
+    ChainIndex index(head);
+    size_t length = index.size();
+    size_t read_length = model_.read_length;
+    if (!is_open() || read_length == 0 || length < read_length || model_.coverage <= 0.0) {
+        return;
+    }
+    size_t total = static_cast<size_t>(model_.coverage * length / (2.0 * read_length) + 0.5);
+    size_t chunks = (total + READ_CHUNK_PAIRS - 1) / READ_CHUNK_PAIRS;
+    std::string name = fasta_name(head->get_seq_id());
+
+    // a batch of chunks runs on the pool, then its text is written in chunk order
+    size_t batch = 2 * workers.size();
+    std::vector<std::string> mate1(batch), mate2(batch);
+    for (size_t first = 0; first < chunks; first += batch) {
+        size_t n = std::min(batch, chunks - first);
+        parallel_for(workers, n, [&](size_t b) {
+            size_t chunk = first + b;
+            MutationRNG gen = stream_rng(seed_, RNG_PASS_READS, chrom, chunk);
+            std::normal_distribution<double> insert(model_.insert_mean, model_.insert_sd);
+            std::string read1(read_length, 'N'), read2(read_length, 'N');
+            std::vector<double> uniforms(read_length);
+            mate1[b].clear();
+            mate2[b].clear();
+            size_t end = std::min(total, (chunk + 1) * READ_CHUNK_PAIRS);
+            for (size_t pair = chunk * READ_CHUNK_PAIRS; pair < end; pair++) {
+                double drawn = model_.insert_sd > 0.0 ? insert(gen) : model_.insert_mean;
+                size_t fragment = static_cast<size_t>(std::max(0.0, std::round(drawn)));
+                fragment = std::min(length, std::max(read_length, fragment));
+                size_t start = std::uniform_int_distribution<size_t>(0, length - fragment)(gen);
+                // mate 1 reads forward from the fragment start, mate 2 back from its end
+                index.copy(start, read_length, &read1[0], snps);
+                index.copy(start + fragment - read_length, read_length, &read2[0], snps);
+                reverse_complement(&read2[0], read_length);
+                // fragment from the minus strand, mate 1 is the one at its end
+                if (rng_bits64(gen) & 1) {
+                    std::swap(read1, read2);
+                }
+                unmask(read1);
+                unmask(read2);
+                add_errors(read1, error_, uniforms, gen);
+                add_errors(read2, error_, uniforms, gen);
+                std::string read_name = name + '_' + std::to_string(start) + '_' +
+                                        std::to_string(start + fragment) + '_' + std::to_string(pair);
+                append_fastq(mate1[b], read_name, 1, read1, quality_);
+                append_fastq(mate2[b], read_name, 2, read2, quality_);
+            }
+        });
+        for (size_t b = 0; b < n; b++) {
+            write(0, mate1[b]);
+            write(1, mate2[b]);
+        }
+    }
+    pairs_ += total;
+}
@@ -0,0 +1,82 @@
+#ifndef READSIMULATOR_H
+#define READSIMULATOR_H
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bgzf.h"
+#include "linkedSequence.h"
+#include "snpOverlay.h"
+#include "threadPool.h"
+
+/*
+    Parameters of the paired end reads
+    coverage: mean depth, pairs per chromosome = coverage * length / (2 * read_length)
+    read_length: bases per read, both mates
+    insert_mean/insert_sd: fragment length is normal, clamped to [read_length, chromosome length]
+    error_first/error_last: substitution error probability of the first and last base of a read,
+                            linear in between like the quality drop along an Illumina read
+*/
+struct ReadModel {
+    double coverage = 0.0;
+    size_t read_length = 150;
+    double insert_mean = 400.0;
+    double insert_sd = 50.0;
+    double error_first = 0.001;
+    double error_last = 0.01;
+};
+
+/*
+    Paired end FASTQ reads sampled from mutated chromosomes, taken straight from the LS chains
+    every read is copied out of the Sequence its LS point at (reverse complemented, unpacked and with
+    the SNP overlay patched in as needed), a mutated chromosome is never built as one string
+
+    fragments are drawn in chunks of READ_CHUNK_PAIRS pairs, chunk k of chromosome c has its own RNG stream,
+    chunks run on the worker pool and are written in order, so the reads only depend on the seed
+    mate 1 goes to <prefix>_R1.fq and mate 2 to <prefix>_R2.fq (.gz, BGZF, if bgzf_threads > 0)
+*/
+class ReadSimulator {
+    public:
+        static constexpr size_t READ_CHUNK_PAIRS = 1 << 13;
+
+        ReadSimulator(const ReadModel& model, const std::string& prefix, uint64_t seed, size_t bgzf_threads = 0);
+        // flush and close both files
+        ~ReadSimulator();
+
+        ReadSimulator(const ReadSimulator&) = delete;
+        ReadSimulator& operator=(const ReadSimulator&) = delete;
+
+        bool is_open() const {
+            return bgzf_[0] != nullptr || file_[0] != nullptr;
+        }
+
+        /*
+            write the reads of the mutated chromosome starting at head, chrom is its index in the genome
+            (picks the RNG streams), snps (if given) are patched into the reads
+            call in chromosome order, head must not change until this returns
+        */
+        void simulate(const LinkedSequence* head, size_t chrom, ThreadPool& workers,
+                      const SnpOverlay* snps = nullptr);
+
+        // pairs written so far
+        size_t pairs() const {
+            return pairs_;
+        }
+
+    private:
+        ReadModel model_;
+        uint64_t seed_;
+        // phred+33 quality of every read position, from the error probability there
+        std::string quality_;
+        std::vector<double> error_;
+        FILE* file_[2];
+        std::unique_ptr<BgzfWriter> bgzf_[2];
+        size_t pairs_;
+
+        void write(int mate, const std::string& text);
+};
+
+#endif // READSIMULATOR_H
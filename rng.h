@@ -0,0 +1,137 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <random>
+
+/*
+    xoshiro256++ (Blackman and Vigna), 256 bits of state and a handful of adds, shifts and xors per
+    64 bit output, against 5 KB of state and a table refill every 624 outputs for std::mt19937
+    meets UniformRandomBitGenerator, so the standard distributions take it as is
+*/
+class Xoshiro256pp {
+    public:
+        typedef uint64_t result_type;
+
+        static constexpr result_type min() {
+            return 0;
+        }
+
+        static constexpr result_type max() {
+            return std::numeric_limits<result_type>::max();
+        }
+
+        /*
+            seed the 4 state words from a std::seed_seq (or anything with generate), like the std engines
+        */
+        template <typename SeedSeq>
+        explicit Xoshiro256pp(SeedSeq& seq) {
+            uint32_t words[8];
+            seq.generate(words, words + 8);
+            for (int i = 0; i < 4; i++) {
+                s_[i] = (static_cast<uint64_t>(words[2 * i + 1]) << 32) | words[2 * i];
+            }
+            // all zero state never leaves zero
+            if ((s_[0] | s_[1] | s_[2] | s_[3]) == 0) {
+                s_[0] = 0x9E3779B97F4A7C15ULL;
+            }
+        }
+
+        result_type operator()() {
+            uint64_t result = rotl(s_[0] + s_[3], 23) + s_[0];
+            uint64_t t = s_[1] << 17;
+            s_[2] ^= s_[0];
+            s_[3] ^= s_[1];
+            s_[1] ^= s_[2];
+            s_[0] ^= s_[3];
+            s_[2] ^= t;
+            s_[3] = rotl(s_[3], 45);
+            return result;
+        }
+
+        /*
+            write the next n outputs to out, same values as n calls to operator()
+            the state lives in locals for the whole loop instead of going back to memory every output
+        */
+        void fill(uint64_t* out, size_t n) {
+            uint64_t s0 = s_[0], s1 = s_[1], s2 = s_[2], s3 = s_[3];
+            for (size_t i = 0; i < n; i++) {
+                out[i] = rotl(s0 + s3, 23) + s0;
+                uint64_t t = s1 << 17;
+                s2 ^= s0;
+                s3 ^= s1;
+                s1 ^= s2;
+                s0 ^= s3;
+                s2 ^= t;
+                s3 = rotl(s3, 45);
+            }
+            s_[0] = s0;
+            s_[1] = s1;
+            s_[2] = s2;
+            s_[3] = s3;
+        }
+
+    private:
+        static uint64_t rotl(uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+
+        uint64_t s_[4];
+};
+
+/*
+    engine used by every mutation pass, picked at compile time
+    make RNG=mt19937 (-DRNG_MT19937) goes back to std::mt19937, outputs differ between engines for a given seed
+*/
+#ifdef RNG_MT19937
+typedef std::mt19937 MutationRNG;
+#else
+typedef Xoshiro256pp MutationRNG;
+#endif
+
+/*
+    next 64 random bits of gen, two draws for a 32 bit engine
+*/
+template <typename URNG>
+inline uint64_t rng_bits64(URNG& gen) {
+    static_assert(URNG::min() == 0 && (URNG::max() == 0xFFFFFFFFull || URNG::max() == ~0ull),
+                  "URNG must give 32 or 64 random bits");
+    if (URNG::max() == 0xFFFFFFFFull) {
+        uint64_t high = gen();
+        return (high << 32) | static_cast<uint64_t>(gen());
+    }
+    return static_cast<uint64_t>(gen());
+}
+
+/*
+    block APIs, fill out[0..n) in one loop
+    rng_fill writes 64 random bits per entry, rng_fill_uniform doubles in (0, 1] with 53 random bits
+*/
+template <typename URNG>
+inline void rng_fill(URNG& gen, uint64_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = rng_bits64(gen);
+    }
+}
+
+inline void rng_fill(Xoshiro256pp& gen, uint64_t* out, size_t n) {
+    gen.fill(out, n);
+}
+
+template <typename URNG>
+inline void rng_fill_uniform(URNG& gen, double* out, size_t n) {
+    // raw bits a block at a time, then a branch free conversion loop the compiler can vectorize
+    const size_t BLOCK = 256;
+    uint64_t bits[BLOCK];
+    for (size_t done = 0; done < n; done += BLOCK) {
+        size_t k = n - done < BLOCK ? n - done : BLOCK;
+        rng_fill(gen, bits, k);
+        for (size_t i = 0; i < k; i++) {
+            out[done + i] = static_cast<double>((bits[i] >> 11) + 1) * (1.0 / 9007199254740992.0);
+        }
+    }
+}
+
+#endif // RNG_H
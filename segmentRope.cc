@@ -0,0 +1,243 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "linkedSequence.h"
+#include "segmentRope.h"
+
+/*----------Construction----------*/
+SegmentRope::SegmentRope(SegmentPool* pool)
+    : root_(NIL), prio_state_(0x9E3779B97F4A7C15ULL), pool_(pool) {}
+
+SegmentRope::SegmentRope(const LinkedSequence* head) : SegmentRope(head->pool_) {
+    for (const LinkedSequence* ls = head; ls != nullptr; ls = ls->next_) {
+        if (ls->is_empty() == false) {
+            root_ = merge(root_, new_node(Piece{ls->seq_, ls->start_, ls->end_, ls->reversed_}));
+        }
+    }
+}
+
+uint32_t SegmentRope::new_node(const Piece& piece) {
+    // xorshift64*, fixed seed so the shape of the rope is reproducible
+    prio_state_ ^= prio_state_ >> 12;
+    prio_state_ ^= prio_state_ << 25;
+    prio_state_ ^= prio_state_ >> 27;
+    uint32_t prio = static_cast<uint32_t>((prio_state_ * 0x2545F4914F6CDD1DULL) >> 32);
+
+    Node node{piece, piece.size(), prio, NIL, NIL};
+    if (!free_.empty()) {
+        uint32_t t = free_.back();
+        free_.pop_back();
+        nodes_[t] = node;
+        return t;
+    }
+    nodes_.push_back(node);
+    return static_cast<uint32_t>(nodes_.size() - 1);
+}
+
+void SegmentRope::free_tree(uint32_t t) {
+    // explicit stack, a detached range can be arbitrarily large
+    std::vector<uint32_t> stack;
+    if (t != NIL) {
+        stack.push_back(t);
+    }
+    while (!stack.empty()) {
+        uint32_t cur = stack.back();
+        stack.pop_back();
+        if (nodes_[cur].left != NIL) {
+            stack.push_back(nodes_[cur].left);
+        }
+        if (nodes_[cur].right != NIL) {
+            stack.push_back(nodes_[cur].right);
+        }
+        free_.push_back(cur);
+    }
+}
+
+/*----------Treap primitives----------*/
+uint32_t SegmentRope::merge(uint32_t l, uint32_t r) {
+    if (l == NIL) {
+        return r;
+    }
+    if (r == NIL) {
+        return l;
+    }
+    if (nodes_[l].prio > nodes_[r].prio) {
+        nodes_[l].right = merge(nodes_[l].right, r);
+        update(l);
+        return l;
+    }
+    nodes_[r].left = merge(l, nodes_[r].left);
+    update(r);
+    return r;
+}
+
+void SegmentRope::split_tree(uint32_t t, size_t pos, uint32_t& l, uint32_t& r) {
+    if (t == NIL) {
+        l = r = NIL;
+        return;
+    }
+    size_t left_total = nodes_[t].left == NIL ? 0 : nodes_[nodes_[t].left].total;
+    size_t piece_size = nodes_[t].piece.size();
+    if (pos <= left_total) {
+        // cut falls in the left subtree, t goes right
+        uint32_t ll, lr;
+        split_tree(nodes_[t].left, pos, ll, lr);
+        nodes_[t].left = lr;
+        update(t);
+        l = ll;
+        r = t;
+    } else if (pos >= left_total + piece_size) {
+        // cut falls in the right subtree, t goes left
+        uint32_t rl, rr;
+        split_tree(nodes_[t].right, pos - left_total - piece_size, rl, rr);
+        nodes_[t].right = rl;
+        update(t);
+        l = t;
+        r = rr;
+    } else {
+        // cut falls inside the piece of t, same as LS split
+        Piece whole = nodes_[t].piece;
+        size_t cut = pos - left_total;
+        Piece tail = whole.sub(cut, whole.size() - cut);
+        nodes_[t].piece = whole.sub(0, cut);
+        uint32_t right = nodes_[t].right;
+        nodes_[t].right = NIL;
+        update(t);
+        l = t;
+        r = merge(new_node(tail), right);
+    }
+}
+
+void SegmentRope::collect(uint32_t t, size_t pos, size_t len, std::vector<Piece>& out) const {
+    if (t == NIL || len == 0) {
+        return;
+    }
+    const Node& n = nodes_[t];
+    size_t left_total = n.left == NIL ? 0 : nodes_[n.left].total;
+    size_t piece_size = n.piece.size();
+    if (pos < left_total) {
+        collect(n.left, pos, len, out);
+    }
+    // overlap of [pos, pos+len) with this piece
+    size_t lo = pos > left_total ? pos - left_total : 0;
+    size_t hi = pos + len - left_total;
+    if (pos + len > left_total && lo < piece_size) {
+        hi = hi < piece_size ? hi : piece_size;
+        out.push_back(n.piece.sub(lo, hi - lo));
+    }
+    if (pos + len > left_total + piece_size) {
+        size_t skip = left_total + piece_size;
+        size_t sub_pos = pos > skip ? pos - skip : 0;
+        collect(n.right, sub_pos, pos + len - skip - sub_pos, out);
+    }
+}
+
+/*----------Public API----------*/
+SegmentRope::Piece SegmentRope::locate(size_t pos, size_t* offset) const {
+    assert(pos < size() && "Invalid input: pos < size()");
+    uint32_t t = root_;
+    while (true) {
+        const Node& n = nodes_[t];
+        size_t left_total = n.left == NIL ? 0 : nodes_[n.left].total;
+        if (pos < left_total) {
+            t = n.left;
+        } else if (pos < left_total + n.piece.size()) {
+            *offset = pos - left_total;
+            return n.piece;
+        } else {
+            pos -= left_total + n.piece.size();
+            t = n.right;
+        }
+    }
+}
+
+char SegmentRope::get_seq_at(size_t pos) const {
+    size_t offset;
+    Piece piece = locate(pos, &offset);
+    char base = piece.seq->base_at(piece.seq_pos(offset));
+    return piece.reversed ? complement_base(base) : base;
+}
+
+void SegmentRope::split(size_t pos) {
+    uint32_t l, r;
+    split_tree(root_, pos, l, r);
+    root_ = merge(l, r);
+}
+
+void SegmentRope::insert_seq(Sequence* seq, size_t pos) {
+    assert(pos <= size() && "Invalid input: pos <= size()");
+    pool_->adopt(seq);
+    insert_pieces(pos, std::vector<Piece>{Piece{seq, 0, seq->size() - 1, false}});
+}
+
+void SegmentRope::insert_pieces(size_t pos, const std::vector<Piece>& pieces) {
+    assert(pos <= size() && "Invalid input: pos <= size()");
+    uint32_t middle = NIL;
+    for (const Piece& piece : pieces) {
+        middle = merge(middle, new_node(piece));
+    }
+    uint32_t l, r;
+    split_tree(root_, pos, l, r);
+    root_ = merge(merge(l, middle), r);
+}
+
+void SegmentRope::delete_section(size_t pos, size_t size) {
+    if (pos >= this->size()) {
+        return;
+    }
+    uint32_t l, m, r;
+    split_tree(root_, pos, l, r);
+    split_tree(r, size, m, r);
+    free_tree(m);
+    root_ = merge(l, r);
+}
+
+std::vector<SegmentRope::Piece> SegmentRope::pieces(size_t pos, size_t len) const {
+    std::vector<Piece> out;
+    if (pos < size()) {
+        collect(root_, pos, len < size() - pos ? len : size() - pos, out);
+    }
+    return out;
+}
+
+size_t SegmentRope::extract(size_t pos, size_t len, char* out) const {
+    size_t copied = 0;
+    for (const Piece& piece : pieces(pos, len)) {
+        piece.seq->copy_bases(piece.start, piece.size(), out + copied);
+        if (piece.reversed) {
+            reverse_complement(out + copied, piece.size());
+        }
+        copied += piece.size();
+    }
+    return copied;
+}
+
+void SegmentRope::to_linked(LinkedSequence* head) const {
+    std::vector<Piece> all = pieces(0, size());
+    head->next_ = nullptr;
+    if (all.empty()) {
+        // every base deleted, mark head as empty
+        head->start_ = head->end_ + 1;
+        return;
+    }
+    LinkedSequence* tail = head;
+    size_t i = 0;
+    if (all[0].seq == head->seq_) {
+        head->start_ = all[0].start;
+        head->end_ = all[0].end;
+        head->reversed_ = all[0].reversed;
+        i = 1;
+    } else {
+        // after a translocation the first piece can come from another chromosome,
+        // head keeps its Sequence (the FA header comes from it) and stays empty in front
+        head->start_ = head->end_ + 1;
+    }
+    for (; i < all.size(); i++) {
+        tail->next_ = head->pool_->make(all[i].seq, all[i].start, all[i].end, nullptr, head->pool_,
+                                        all[i].reversed);
+        tail = tail->next_;
+    }
+}
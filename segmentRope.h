@@ -0,0 +1,150 @@
+#ifndef SEGMENTROPE_H
+#define SEGMENTROPE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "linkedSequence.h"
+
+/*
+    Balanced, order statistic version of the LS chain (a treap keyed by position, aka a rope)
+    each node holds one piece (Sequence, start, end inclusive) like an LS, plus the total number
+    of bases in its subtree, so a position in the mutated coordinate space is found in O(log n)
+    instead of walking next_ from the head
+
+    positions here are always mutated coordinates, 0 based from the first visible base,
+    NOT positions inside the underlying Sequence like the LS API
+
+    split/insert_seq/delete_section mirror the LS API, the LS chain stays the default representation,
+    build a rope from a chain with SegmentRope(head) and write it back with to_linked(head)
+*/
+class SegmentRope {
+    public:
+        /*
+            one visible slice of a Sequence, start/end inclusive like LS
+            a reversed piece shows the reverse complement of its bases
+        */
+        struct Piece {
+            Sequence* seq;
+            size_t start;
+            size_t end;
+            bool reversed;
+
+            size_t size() const {
+                return end - start + 1;
+            }
+
+            // Sequence position of the base offset bases after the visible front
+            size_t seq_pos(size_t offset) const {
+                return reversed ? end - offset : start + offset;
+            }
+
+            // the n visible bases starting offset bases after the visible front
+            Piece sub(size_t offset, size_t n) const {
+                if (reversed) {
+                    return Piece{seq, end - offset - n + 1, end - offset, true};
+                }
+                return Piece{seq, start + offset, start + offset + n - 1, false};
+            }
+        };
+
+        /*
+            Construct an empty rope, inserted Sequence are handed to pool
+        */
+        explicit SegmentRope(SegmentPool* pool);
+
+        /*
+            Construct rope holding every non empty LS from head to the end of the chain
+        */
+        explicit SegmentRope(const LinkedSequence* head);
+
+        // total number of visible bases
+        size_t size() const {
+            return root_ == NIL ? 0 : nodes_[root_].total;
+        }
+
+        size_t piece_count() const {
+            return nodes_.size() - free_.size();
+        }
+
+        /*
+            return the piece holding pos, and the offset of pos inside that piece in *offset
+            O(log n)
+        */
+        Piece locate(size_t pos, size_t* offset) const;
+
+        /*
+            return the visible base at pos, complemented if its piece is reversed
+        */
+        char get_seq_at(size_t pos) const;
+
+        /*
+            make pos the first base of a piece, nothing to do if it already is
+        */
+        void split(size_t pos);
+
+        /*
+            Insert the whole of seq so that its first base ends up at pos
+            pos == size() appends, the pool takes ownership of seq
+        */
+        void insert_seq(Sequence* seq, size_t pos);
+
+        /*
+            Insert pieces (in order) so the first one starts at pos, no bases are copied
+            used to duplicate a range, ex. insert_pieces(end, pieces(start, len))
+        */
+        void insert_pieces(size_t pos, const std::vector<Piece>& pieces);
+
+        /*
+            remove size bases starting at pos, over delete past the end is ok
+            as with LS, no actual data is deleted
+        */
+        void delete_section(size_t pos, size_t size);
+
+        /*
+            return the pieces covering [pos, pos+len), cut at both ends
+        */
+        std::vector<Piece> pieces(size_t pos, size_t len) const;
+
+        /*
+            copy up to len bases starting at pos into out, return the number copied
+        */
+        size_t extract(size_t pos, size_t len, char* out) const;
+
+        /*
+            rewrite the chain starting at head to match the rope, head keeps its identity and Sequence
+            new LS come from the pool of head
+        */
+        void to_linked(LinkedSequence* head) const;
+
+    private:
+        static constexpr uint32_t NIL = UINT32_MAX;
+
+        struct Node {
+            Piece piece;
+            size_t total;
+            uint32_t prio;
+            uint32_t left;
+            uint32_t right;
+        };
+
+        std::vector<Node> nodes_;
+        std::vector<uint32_t> free_;
+        uint32_t root_;
+        uint64_t prio_state_;
+        SegmentPool* pool_;
+
+        uint32_t new_node(const Piece& piece);
+        void free_tree(uint32_t t);
+        void update(uint32_t t) {
+            Node& n = nodes_[t];
+            n.total = n.piece.size() + (n.left == NIL ? 0 : nodes_[n.left].total) +
+                      (n.right == NIL ? 0 : nodes_[n.right].total);
+        }
+        uint32_t merge(uint32_t l, uint32_t r);
+        // l gets the first pos bases of t, r the rest, a piece holding pos is cut in two
+        void split_tree(uint32_t t, size_t pos, uint32_t& l, uint32_t& r);
+        void collect(uint32_t t, size_t pos, size_t len, std::vector<Piece>& out) const;
+};
+
+#endif // SEGMENTROPE_H
@@ -0,0 +1,280 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "snapshot.h"
+
+static const char SNAPSHOT_MAGIC[8] = {'G', 'M', 'S', 'N', 'A', 'P', '0', '1'};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint64_t seed;
+    uint64_t passes_done;
+    uint64_t sequence_count;
+    uint64_t reference_count;
+    uint64_t chain_count;
+    uint64_t ls_count;
+    uint64_t table_offset;
+};
+
+// one LS of a chain
+struct SnapshotLS {
+    uint32_t seq;
+    uint32_t reversed;
+    uint64_t start;
+    uint64_t end;
+};
+
+/*---------------saving---------------*/
+static void put_u64(std::string& out, uint64_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void put_string(std::string& out, const std::string& text) {
+    put_u64(out, text.size());
+    out.append(text);
+}
+
+// bases of seq then "\n", straight from the Sequence if plain, unpacked through a buffer otherwise
+static bool write_bases(FILE* file, Sequence* seq) {
+    size_t n = seq->size();
+    const char* plain = n > 0 ? seq->plain_bases(0) : nullptr;
+    if (plain != nullptr) {
+        if (fwrite(plain, 1, n, file) != n) {
+            return false;
+        }
+    } else {
+        std::vector<char> buffer(1 << 20);
+        for (size_t done = 0; done < n; done += buffer.size()) {
+            size_t k = std::min(buffer.size(), n - done);
+            seq->copy_bases(done, k, buffer.data());
+            if (fwrite(buffer.data(), 1, k, file) != k) {
+                return false;
+            }
+        }
+    }
+    return fputc('\n', file) != EOF;
+}
+
+bool save_snapshot(const char* path, const std::vector<Sequence*>& reference,
+                   const std::vector<LinkedSequence*>& linkedseqs, const SnapshotInfo& info) {
+    // number every Sequence, the reference first so its indices match the FA order
+    std::vector<Sequence*> sequences(reference.begin(), reference.end());
+    std::unordered_map<const Sequence*, uint32_t> index;
+    for (uint32_t i = 0; i < sequences.size(); i++) {
+        index[sequences[i]] = i;
+    }
+    std::vector<uint64_t> chain_sizes;
+    std::vector<SnapshotLS> nodes;
+    for (const LinkedSequence* head : linkedseqs) {
+        size_t before = nodes.size();
+        for (const LinkedSequence* ls = head; ls != nullptr; ls = ls->get_next()) {
+            if (ls->is_empty() && ls != head) {
+                continue;
+            }
+            auto found = index.find(ls->get_seq());
+            if (found == index.end()) {
+                found = index.emplace(ls->get_seq(), static_cast<uint32_t>(sequences.size())).first;
+                sequences.push_back(ls->get_seq());
+            }
+            nodes.push_back(SnapshotLS{found->second, ls->is_reversed() ? 1u : 0u, ls->get_start(), ls->get_end()});
+        }
+        chain_sizes.push_back(nodes.size() - before);
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        std::cerr << "Unable to open snapshot file " << path << std::endl;
+        return false;
+    }
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.seed = info.seed;
+    header.passes_done = info.passes_done;
+    header.sequence_count = sequences.size();
+    header.reference_count = reference.size();
+    header.chain_count = linkedseqs.size();
+    header.ls_count = nodes.size();
+    header.table_offset = 0;  // known once the bases are out, the header is written again then
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    std::vector<uint64_t> offsets;
+    for (Sequence* seq : sequences) {
+        offsets.push_back(static_cast<uint64_t>(ftell(file)));
+        ok = ok && write_bases(file, seq);
+    }
+
+    std::string table;
+    put_string(table, info.fasta);
+    for (size_t i = 0; i < sequences.size(); i++) {
+        put_u64(table, offsets[i]);
+        put_u64(table, sequences[i]->size());
+        put_string(table, sequences[i]->id);
+    }
+    for (uint64_t size : chain_sizes) {
+        put_u64(table, size);
+    }
+    header.table_offset = static_cast<uint64_t>(ftell(file));
+    ok = ok && fwrite(table.data(), 1, table.size(), file) == table.size();
+    ok = ok && fwrite(nodes.data(), sizeof(SnapshotLS), nodes.size(), file) == nodes.size();
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        std::cerr << "Unable to write snapshot file " << path << std::endl;
+    }
+    return ok;
+}
+
+/*---------------loading---------------*/
+/*
+    bounds checked reader over the table section of the mapping
+*/
+class TableReader {
+    public:
+        TableReader(const char* data, size_t size) : data_(data), left_(size), ok_(true) {}
+
+        bool ok() const {
+            return ok_;
+        }
+
+        // mark the table bad, ex. an entry that points outside the file
+        void fail() {
+            ok_ = false;
+        }
+
+        // copy n bytes into out, false (and ok() false from then on) if fewer are left
+        bool read(void* out, size_t n) {
+            if (!ok_ || n > left_) {
+                ok_ = false;
+                return false;
+            }
+            memcpy(out, data_, n);
+            data_ += n;
+            left_ -= n;
+            return true;
+        }
+
+        uint64_t u64() {
+            uint64_t value = 0;
+            read(&value, sizeof(value));
+            return value;
+        }
+
+        std::string text() {
+            uint64_t n = u64();
+            if (!ok_ || n > left_) {
+                ok_ = false;
+                return std::string();
+            }
+            std::string out(data_, n);
+            data_ += n;
+            left_ -= n;
+            return out;
+        }
+
+    private:
+        const char* data_;
+        size_t left_;
+        bool ok_;
+};
+
+bool load_snapshot(const char* path, bool packed, std::vector<Sequence*>& reference,
+                   std::vector<LinkedSequence*>& linkedseqs, SnapshotInfo& info) {
+    std::shared_ptr<MappedFasta> file = std::make_shared<MappedFasta>(path, false);
+    SnapshotHeader header;
+    if (!file->is_open() || file->file_size() < sizeof(header)) {
+        std::cerr << "Unable to read snapshot file " << path << std::endl;
+        return false;
+    }
+    memcpy(&header, file->bytes(), sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.table_offset > file->file_size() || header.reference_count > header.sequence_count) {
+        std::cerr << path << " is not a snapshot file" << std::endl;
+        return false;
+    }
+
+    TableReader table(file->bytes() + header.table_offset, file->file_size() - header.table_offset);
+    info.fasta = table.text();
+    info.seed = header.seed;
+    info.passes_done = header.passes_done;
+    std::vector<FaiRecord> records;
+    std::vector<std::string> ids;
+    for (uint64_t i = 0; i < header.sequence_count && table.ok(); i++) {
+        uint64_t offset = table.u64();
+        uint64_t length = table.u64();
+        ids.push_back(table.text());
+        // every Sequence is a single line, so the mapping reads it with one copy
+        records.push_back(FaiRecord{std::string(), length, offset, length, length + 1});
+        if (offset > header.table_offset || length > header.table_offset - offset) {
+            table.fail();
+        }
+    }
+    std::vector<uint64_t> chain_sizes;
+    uint64_t total = 0;
+    for (uint64_t c = 0; c < header.chain_count && table.ok(); c++) {
+        chain_sizes.push_back(table.u64());
+        total += chain_sizes.back();
+    }
+    std::vector<SnapshotLS> nodes(table.ok() && total == header.ls_count ? total : 0);
+    if (!nodes.empty()) {
+        table.read(nodes.data(), nodes.size() * sizeof(SnapshotLS));
+    }
+    bool valid = table.ok() && total == header.ls_count;
+    for (const SnapshotLS& node : nodes) {
+        valid = valid && node.seq < header.sequence_count && node.start <= records[node.seq].length &&
+                node.end + 1 >= node.start && (node.end < records[node.seq].length || node.end + 1 == node.start);
+    }
+    for (uint64_t size : chain_sizes) {
+        valid = valid && size > 0;
+    }
+    if (!valid) {
+        std::cerr << "Corrupt snapshot file " << path << std::endl;
+        return false;
+    }
+    file->set_records(std::move(records));
+
+    // every Sequence reads its bases from the mapping on first use
+    std::vector<Sequence*> sequences;
+    for (uint64_t i = 0; i < header.sequence_count; i++) {
+        sequences.push_back(new Sequence(ids[i], file, i, packed));
+    }
+    reference.assign(sequences.begin(), sequences.begin() + header.reference_count);
+    linkedseqs.clear();
+    std::vector<bool> owned(sequences.size(), false);
+    size_t next = 0;
+    for (uint64_t size : chain_sizes) {
+        SegmentPool* pool = new SegmentPool();
+        LinkedSequence* head = nullptr;
+        LinkedSequence* tail = nullptr;
+        for (uint64_t k = 0; k < size; k++, next++) {
+            const SnapshotLS& node = nodes[next];
+            Sequence* seq = sequences[node.seq];
+            if (node.seq >= header.reference_count && !owned[node.seq]) {
+                pool->adopt(seq);
+                owned[node.seq] = true;
+            }
+            LinkedSequence* ls = pool->make(seq, node.start, node.end, nullptr, pool, node.reversed != 0);
+            if (head == nullptr) {
+                head = ls;
+            } else {
+                tail->set_next(ls);
+            }
+            tail = ls;
+        }
+        linkedseqs.push_back(head);
+    }
+    // inserted Sequences are copied in now, a chain may share one with another chain (SV) and passes
+    // run chains in parallel, the ones no chain uses any more are dropped
+    for (size_t i = header.reference_count; i < sequences.size(); i++) {
+        if (owned[i]) {
+            sequences[i]->materialize();
+        } else {
+            delete sequences[i];
+        }
+    }
+    return true;
+}
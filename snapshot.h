@@ -0,0 +1,51 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "io.h"
+#include "linkedSequence.h"
+
+/*
+    Run state kept in a snapshot besides the genome
+    fasta: reference FA of the run, names the outputs of a resumed run
+    seed: RNG seed of the run, a resumed run keeps it unless given another one
+    passes_done: number of mutation passes (SV, CNV, INDEL, SNP in that order) already applied
+*/
+struct SnapshotInfo {
+    std::string fasta;
+    uint64_t seed = 0;
+    uint64_t passes_done = 0;
+};
+
+/*
+    Binary snapshot of a mutated genome: the bases of every Sequence the chains use (the reference ones,
+    SNP included, then every inserted one) and every LS chain as (Sequence index, start, end, orientation)
+    native byte order, meant to be reloaded on the machine that wrote it
+
+        header      "GMSNAP01", seed, passes_done, Sequence/reference/chain/LS counts, table offset
+        bases       every Sequence as one line of plain bases, so the loader maps them like a one line FA record
+        table       fasta path, then offset/length/id of every Sequence, LS count of every chain,
+                    then every LS of every chain in order
+
+    empty LS are left out except the head of a chain, which names the mutated chromosome
+    write the snapshot at path, return false if it couldn't be written
+*/
+bool save_snapshot(const char* path, const std::vector<Sequence*>& reference,
+                   const std::vector<LinkedSequence*>& linkedseqs, const SnapshotInfo& info);
+
+/*
+    map the snapshot at path and rebuild reference (the reference Sequences, in FA order) and linkedseqs
+    (one chain per chromosome, ready for more passes or output) without reading the FA
+    reference bases are copied out of the mapping on first use like load_fasta, inserted ones right away,
+    packed = true packs them then
+    inserted Sequences are owned by the pool of the first chain using them, free with free_linkedseqs and
+    free_vector(reference) as usual
+    return false (and nothing allocated) if path is not a readable snapshot
+*/
+bool load_snapshot(const char* path, bool packed, std::vector<Sequence*>& reference,
+                   std::vector<LinkedSequence*>& linkedseqs, SnapshotInfo& info);
+
+#endif // SNAPSHOT_H
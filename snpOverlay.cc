@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include "snpOverlay.h"
+
+std::vector<SnpOverlay::Snp>::const_iterator SnpOverlay::lower_bound(const std::vector<Snp>& list, size_t pos) {
+    return std::lower_bound(list.begin(), list.end(), pos,
+                            [](const Snp& snp, size_t p) { return snp.pos < p; });
+}
+
+void SnpOverlay::append(const Sequence* seq, const std::vector<Snp>& snps) {
+    if (snps.empty()) {
+        return;
+    }
+    std::vector<Snp>& list = snps_[seq];
+    assert((list.empty() || list.back().pos < snps.front().pos) && "snps must be appended in pos order");
+    list.insert(list.end(), snps.begin(), snps.end());
+    count_ += snps.size();
+}
+
+bool SnpOverlay::touches(const Sequence* seq, size_t pos, size_t n) const {
+    auto found = snps_.find(seq);
+    if (found == snps_.end()) {
+        return false;
+    }
+    auto it = lower_bound(found->second, pos);
+    return it != found->second.end() && it->pos < pos + n;
+}
+
+void SnpOverlay::apply(const Sequence* seq, size_t pos, size_t n, char* out) const {
+    auto found = snps_.find(seq);
+    if (found == snps_.end()) {
+        return;
+    }
+    for (auto it = lower_bound(found->second, pos); it != found->second.end() && it->pos < pos + n; ++it) {
+        out[it->pos - pos] = it->base;
+    }
+}
+
+bool SnpOverlay::Cursor::seek(const Sequence* seq, size_t pos) {
+    if (seq != seq_ || list_ == nullptr || pos < last_pos_) {
+        if (seq != seq_) {
+            auto found = overlay_.snps_.find(seq);
+            seq_ = seq;
+            list_ = found == overlay_.snps_.end() ? nullptr : &found->second;
+        }
+        if (list_ == nullptr) {
+            return false;
+        }
+        next_ = lower_bound(*list_, pos) - list_->begin();
+    } else {
+        // gallop to a snp at or after pos, then search the last step only
+        const std::vector<Snp>& list = *list_;
+        size_t low = next_;
+        size_t step = 1;
+        while (low + step < list.size() && list[low + step].pos < pos) {
+            low += step;
+            step *= 2;
+        }
+        size_t high = std::min(list.size(), low + step + 1);
+        next_ = std::lower_bound(list.begin() + low, list.begin() + high, pos,
+                                 [](const Snp& snp, size_t p) { return snp.pos < p; }) - list.begin();
+    }
+    last_pos_ = pos;
+    return true;
+}
+
+bool SnpOverlay::Cursor::touches(const Sequence* seq, size_t pos, size_t n) {
+    return seek(seq, pos) && next_ < list_->size() && (*list_)[next_].pos < pos + n;
+}
+
+void SnpOverlay::Cursor::apply(const Sequence* seq, size_t pos, size_t n, char* out) {
+    if (!seek(seq, pos)) {
+        return;
+    }
+    const std::vector<Snp>& list = *list_;
+    for (size_t i = next_; i < list.size() && list[i].pos < pos + n; i++) {
+        out[list[i].pos - pos] = list[i].base;
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef SNPOVERLAY_H
+#define SNPOVERLAY_H
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "io.h"
+
+/*
+    Per haplotype SNP, kept on the side instead of written into the shared Sequence
+    so any number of haplotypes can be made from one reference, memory grows with the number of SNP only
+
+    like an in place SNP, a changed base shows up in every LS that points at it (ex. CNV copies)
+*/
+class SnpOverlay {
+    public:
+        struct Snp {
+            size_t pos;
+            char base;
+        };
+
+        SnpOverlay() : count_(0) {}
+
+        /*
+            add snps of seq, sorted by pos and all after any snp of seq already added
+        */
+        void append(const Sequence* seq, const std::vector<Snp>& snps);
+
+        size_t size() const {
+            return count_;
+        }
+
+        bool empty() const {
+            return count_ == 0;
+        }
+
+        /*
+            return true if any base in [pos, pos+n) of seq is changed
+        */
+        bool touches(const Sequence* seq, size_t pos, size_t n) const;
+
+        /*
+            out holds the n bases of seq starting at pos, overwrite the changed ones
+        */
+        void apply(const Sequence* seq, size_t pos, size_t n, char* out) const;
+
+        /*
+            Lookups of one walk over the overlay, meant for walks that go forward within a Sequence
+            (ex. writing a chain out), same answers as touches/apply on the overlay
+            keeps the list of the last Sequence and where its last lookup landed, a lookup at or after
+            that position gallops forward from there instead of searching the whole list
+        */
+        class Cursor {
+            public:
+                explicit Cursor(const SnpOverlay& overlay)
+                    : overlay_(overlay), seq_(nullptr), list_(nullptr), next_(0), last_pos_(0) {}
+
+                bool touches(const Sequence* seq, size_t pos, size_t n);
+
+                void apply(const Sequence* seq, size_t pos, size_t n, char* out);
+
+            private:
+                const SnpOverlay& overlay_;
+                const Sequence* seq_;
+                // snps of seq_, nullptr if it has none
+                const std::vector<Snp>* list_;
+                // index of the first snp of list_ at or after last_pos_
+                size_t next_;
+                size_t last_pos_;
+
+                // point next_ at the first snp of seq at or after pos, false if seq has no snp
+                bool seek(const Sequence* seq, size_t pos);
+        };
+
+    private:
+        std::unordered_map<const Sequence*, std::vector<Snp>> snps_;
+        size_t count_;
+
+        // first snp of list at or after pos
+        static std::vector<Snp>::const_iterator lower_bound(const std::vector<Snp>& list, size_t pos);
+};
+
+#endif // SNPOVERLAY_H
@@ -0,0 +1,130 @@
+#include <sys/resource.h>
+
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "stats.h"
+
+/*----------Counters----------*/
+// every block ever handed out, and every stage in the order it first ran
+// blocks outlive their threads and the list is never destroyed, so a late stat_add is still safe
+static std::mutex stat_mutex;
+static std::vector<StatBlock*>& stat_blocks = *new std::vector<StatBlock*>();
+static std::vector<std::pair<std::string, double>> stat_stages;
+
+// report names of every StatCounter before STAT_MUTATIONS
+static const char* const STAT_NAMES[STAT_MUTATIONS] = {
+    "ls_nodes", "ls_splits", "ls_inserts", "ls_deletes", "rng_draws", "bases_inserted",
+    "bytes_parsed", "bytes_written", "write_ns", "record_blocked_ns"
+};
+
+StatBlock* stat_block() {
+    StatBlock* block = new StatBlock();
+    for (std::atomic<uint64_t>& count : block->counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(stat_mutex);
+    stat_blocks.push_back(block);
+    return block;
+}
+
+uint64_t stat_total(int counter) {
+    std::lock_guard<std::mutex> lock(stat_mutex);
+    uint64_t total = 0;
+    for (const StatBlock* block : stat_blocks) {
+        total += block->counts[counter].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+long stat_peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/*----------Stages----------*/
+void stat_stage(const std::string& name, double ms) {
+    std::lock_guard<std::mutex> lock(stat_mutex);
+    for (std::pair<std::string, double>& stage : stat_stages) {
+        if (stage.first == name) {
+            stage.second += ms;
+            return;
+        }
+    }
+    stat_stages.emplace_back(name, ms);
+}
+
+/*----------Report----------*/
+bool write_stats_report(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == nullptr) {
+        std::cerr << "Unable to write stats report " << path << std::endl;
+        return false;
+    }
+#ifdef NO_STATS
+    fprintf(file, "{\n  \"counters_enabled\": false,\n");
+#else
+    fprintf(file, "{\n  \"counters_enabled\": true,\n");
+#endif
+    fprintf(file, "  \"peak_rss_kb\": %ld,\n  \"stages_ms\": {", stat_peak_rss_kb());
+    {
+        std::lock_guard<std::mutex> lock(stat_mutex);
+        for (size_t i = 0; i < stat_stages.size(); i++) {
+            fprintf(file, "%s\"%s\": %.3f", i == 0 ? "" : ", ", stat_stages[i].first.c_str(), stat_stages[i].second);
+        }
+    }
+    fprintf(file, "},\n  \"counters\": {");
+    for (int c = 0; c < STAT_MUTATIONS; c++) {
+        fprintf(file, "%s\"%s\": %llu", c == 0 ? "" : ", ", STAT_NAMES[c],
+                static_cast<unsigned long long>(stat_total(c)));
+    }
+    fprintf(file, "},\n  \"mutations\": {");
+    for (int t = 0; t < MUTATION_TYPE_COUNT; t++) {
+        fprintf(file, "%s\"%s\": %llu", t == 0 ? "" : ", ", mutation_type_name(static_cast<MutationType>(t)),
+                static_cast<unsigned long long>(stat_total(STAT_MUTATIONS + t)));
+    }
+    fprintf(file, "}\n}\n");
+    fclose(file);
+    return true;
+}
+
+/*----------Progress----------*/
+StatProgress::StatProgress(double interval_s) : interval_s_(interval_s), done_(false) {
+    if (interval_s_ > 0.0) {
+        thread_ = std::thread(&StatProgress::loop, this);
+    }
+}
+
+StatProgress::~StatProgress() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+    }
+    changed_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void StatProgress::loop() {
+    auto start = std::chrono::steady_clock::now();
+    auto interval = std::chrono::duration<double>(interval_s_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!changed_.wait_for(lock, interval, [this] { return done_; })) {
+        uint64_t mutations = 0;
+        for (int t = 0; t < MUTATION_TYPE_COUNT; t++) {
+            mutations += stat_total(STAT_MUTATIONS + t);
+        }
+        fprintf(stderr, "[progress %.1f s] mutations %llu, LS %llu, bytes parsed %llu, bytes written %llu, "
+                        "peak RSS %ld KB\n",
+                stat_ns_since(start) / 1e9, static_cast<unsigned long long>(mutations),
+                static_cast<unsigned long long>(stat_total(STAT_NODES)),
+                static_cast<unsigned long long>(stat_total(STAT_BYTES_PARSED)),
+                static_cast<unsigned long long>(stat_total(STAT_BYTES_WRITTEN)), stat_peak_rss_kb());
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "io.h"
+
+/*
+    Run statistics, counters are bumped from the hot paths through STAT_ADD and summed
+    into a JSON report at the end of a run
+    build with make STATS=0 (-DNO_STATS) to compile every STAT_ADD out, stage timers are kept
+
+    every thread bumps its own block of counters, no shared cache line and no locked instruction,
+    blocks are summed when read so a progress thread can read them at any time
+*/
+enum StatCounter {
+    STAT_NODES,           // LS made by SegmentPool
+    STAT_SPLITS,          // LS split in two
+    STAT_INSERTS,         // LS insert_seq
+    STAT_DELETES,         // LS delete_section
+    STAT_RNG_DRAWS,       // samples drawn for mutated positions, indel lengths and bases
+    STAT_BASES_INSERTED,  // bases of every inserted Sequence
+    STAT_BYTES_PARSED,    // FA bytes copied or packed into Sequence
+    STAT_BYTES_WRITTEN,   // mutated FA and mutation record bytes written
+    STAT_WRITE_NS,        // time spent in fwrite, on any thread
+    STAT_BLOCKED_NS,      // time the mutation passes spent waiting on the record writer thread
+    STAT_MUTATIONS,       // first of one counter per MutationType
+    STAT_COUNT = STAT_MUTATIONS + MUTATION_TYPE_COUNT
+};
+
+/*
+    counters of one thread, only that thread writes them
+*/
+struct StatBlock {
+    std::atomic<uint64_t> counts[STAT_COUNT];
+};
+
+// the calling thread's block, registered on first use and never freed
+StatBlock* stat_block();
+
+inline void stat_add(int counter, uint64_t n) {
+    static thread_local StatBlock* block = stat_block();
+    // single writer, a relaxed load + store is enough and avoids a locked add
+    block->counts[counter].store(block->counts[counter].load(std::memory_order_relaxed) + n,
+                                 std::memory_order_relaxed);
+}
+
+// nanoseconds from since to now, for STAT_WRITE_NS/STAT_BLOCKED_NS
+inline uint64_t stat_ns_since(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+/*
+    STAT_ADD(counter, n): add n to counter
+    STAT_TIMED(counter, statement): run statement and add its wall time in ns to counter
+*/
+#ifdef NO_STATS
+#define STAT_ADD(counter, n) ((void)0)
+#define STAT_TIMED(counter, statement) statement
+#else
+#define STAT_ADD(counter, n) stat_add((counter), (n))
+#define STAT_TIMED(counter, statement) \
+    do { \
+        std::chrono::steady_clock::time_point stat_start = std::chrono::steady_clock::now(); \
+        statement; \
+        stat_add((counter), stat_ns_since(stat_start)); \
+    } while (0)
+#endif
+
+// sum of counter over every thread so far
+uint64_t stat_total(int counter);
+
+// peak resident set of the process so far
+long stat_peak_rss_kb();
+
+/*
+    add ms of wall time to stage name, a stage run more than once (ex. per haplotype) adds up
+*/
+void stat_stage(const std::string& name, double ms);
+
+/*
+    times its own lifetime as stage name
+*/
+class StatTimer {
+    public:
+        explicit StatTimer(const std::string& name)
+            : name_(name), start_(std::chrono::steady_clock::now()) {}
+
+        ~StatTimer() {
+            stat_stage(name_, stat_ns_since(start_) / 1e6);
+        }
+
+        StatTimer(const StatTimer&) = delete;
+        StatTimer& operator=(const StatTimer&) = delete;
+
+    private:
+        std::string name_;
+        std::chrono::steady_clock::time_point start_;
+};
+
+/*
+    write every stage time, counter total and the peak RSS to path as JSON
+    return false if path can't be written
+*/
+bool write_stats_report(const char* path);
+
+/*
+    print a progress line with the main counters to stderr every interval_s seconds until destroyed
+    interval_s == 0 prints nothing and starts no thread
+*/
+class StatProgress {
+    public:
+        explicit StatProgress(double interval_s);
+        ~StatProgress();
+
+        StatProgress(const StatProgress&) = delete;
+        StatProgress& operator=(const StatProgress&) = delete;
+
+    private:
+        double interval_s_;
+        bool done_;
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        std::thread thread_;
+
+        void loop();
+};
+
+#endif // STATS_H
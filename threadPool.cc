@@ -0,0 +1,75 @@
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "threadPool.h"
+
+ThreadPool::ThreadPool(size_t threads) : running_(0), stopping_(false) {
+    if (threads <= 1) {
+        return;  // run inline
+    }
+    for (size_t i = 0; i < threads; i++) {
+        workers_.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    task_ready_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    if (workers_.empty()) {
+        task();
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    task_ready_.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    all_done_.wait(lock, [this] { return tasks_.empty() && running_ == 0; });
+}
+
+void ThreadPool::worker_loop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            task_ready_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;  // stopping and nothing left to do
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+            running_++;
+        }
+        task();
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            running_--;
+            if (tasks_.empty() && running_ == 0) {
+                all_done_.notify_all();
+            }
+        }
+    }
+}
+
+void parallel_for(ThreadPool& pool, size_t n, const std::function<void(size_t)>& fn) {
+    for (size_t i = 0; i < n; i++) {
+        pool.submit([&fn, i] { fn(i); });
+    }
+    pool.wait();
+}
@@ -0,0 +1,116 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+    Fixed size pool of worker threads pulling tasks from one shared queue
+    a pool of size 0 or 1 runs every task inline on the calling thread, so single threaded runs
+    don't pay for any synchronization
+*/
+class ThreadPool {
+    public:
+        explicit ThreadPool(size_t threads);
+
+        // waits for queued tasks, then joins the workers
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        /*
+            queue task to run on some worker
+        */
+        void submit(std::function<void()> task);
+
+        /*
+            block until every task submitted so far has finished
+        */
+        void wait();
+
+        // number of threads doing work, at least 1
+        size_t size() const {
+            return workers_.empty() ? 1 : workers_.size();
+        }
+
+    private:
+        std::vector<std::thread> workers_;
+        std::deque<std::function<void()>> tasks_;
+        std::mutex mutex_;
+        std::condition_variable task_ready_;
+        std::condition_variable all_done_;
+        size_t running_;
+        bool stopping_;
+
+        void worker_loop();
+};
+
+/*
+    call fn(i) for every i in [0, n) on the pool and wait for all of them
+    order of the calls is unspecified, fn must only touch data owned by index i
+*/
+void parallel_for(ThreadPool& pool, size_t n, const std::function<void(size_t)>& fn);
+
+/*
+    Fixed capacity FIFO between two pipeline stages, push blocks while it is full and pop while it is empty
+    close() ends the stream: pop returns false once the queue is closed and drained
+*/
+template <typename T>
+class BoundedQueue {
+    public:
+        explicit BoundedQueue(size_t capacity) : capacity_(capacity), closed_(false) {}
+
+        BoundedQueue(const BoundedQueue&) = delete;
+        BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+        void push(T item) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                not_full_.wait(lock, [this] { return items_.size() < capacity_; });
+                items_.push_back(std::move(item));
+            }
+            not_empty_.notify_one();
+        }
+
+        /*
+            move the oldest item into item, false if the queue is closed and nothing is left
+        */
+        bool pop(T& item) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                not_empty_.wait(lock, [this] { return !items_.empty() || closed_; });
+                if (items_.empty()) {
+                    return false;
+                }
+                item = std::move(items_.front());
+                items_.pop_front();
+            }
+            not_full_.notify_one();
+            return true;
+        }
+
+        // no more push, consumers drain what is left
+        void close() {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                closed_ = true;
+            }
+            not_empty_.notify_all();
+        }
+
+    private:
+        size_t capacity_;
+        std::deque<T> items_;
+        std::mutex mutex_;
+        std::condition_variable not_full_;
+        std::condition_variable not_empty_;
+        bool closed_;
+};
+
+#endif // THREADPOOL_H
@@ -1,157 +1,1061 @@
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <fstream>
+#include <functional>
 #include <random>
 #include <string>
 #include <sstream>
 #include <vector>
 
 #include "linkedSequence.h"
+#include "segmentRope.h"
 #include "utils.h"
 
-std::string* gen_n_nucleotides(std::vector<double>& base_prob, size_t n, std::mt19937& gen) {
-    assert(base_prob.size() == 4 && 
+std::string* gen_n_nucleotides(const AliasTable& bases, size_t n, MutationRNG& gen) {
+    assert(bases.size() == 4 && 
         "Base probability must be size 4 for ATCG probability, respectively");
-    std::discrete_distribution<int> gen_nucleotide(base_prob.begin(), base_prob.end());
-    std::ostringstream oss;
+    std::string* out = new std::string();
+    gen_n_nucleotides(bases, n, gen, *out);
+    return out;
+}
+
+void gen_n_nucleotides(const AliasTable& bases, size_t n, MutationRNG& gen, std::string& out) {
+    assert(bases.size() == 4 &&
+        "Base probability must be size 4 for ATCG probability, respectively");
+    out.resize(n);
+    // indices first, then map them to bases in place
+    bases.sample_n(gen, n, out.begin());
+    for (char& base : out) {
+        base = index_to_nucleotide(base);
+    }
+}
 
+Sequence* gen_inserted_seq(const AliasTable& bases, size_t n, MutationRNG& gen, bool packed) {
+    STAT_ADD(STAT_RNG_DRAWS, n);
+    if (!packed) {
+        return new Sequence(std::string(), gen_n_nucleotides(bases, n, gen));
+    }
+    assert(bases.size() == 4 &&
+        "Base probability must be size 4 for ATCG probability, respectively");
+    // write 2 bit codes directly, never going through chars
+    PackedBases* packed_bases = new PackedBases();
+    packed_bases->reserve(n);
     for (size_t i = 0; i < n; i++) {
-        int index = gen_nucleotide(gen);
-        oss << index_to_nucleotide(index);
+        packed_bases->push_code(PackedBases::base_code(index_to_nucleotide(static_cast<int>(bases.sample(gen)))));
     }
-    return new std::string(std::move(oss.str()));
+    return new Sequence(std::string(), packed_bases);
+}
+
+std::string deep_copy_string(Sequence* seq) {
+    std::string out(seq->size(), '\0');
+    seq->copy_bases(0, seq->size(), &out[0]);
+    return out;
 }
 
 std::string deep_copy_string(const LinkedSequence* ls, size_t pos, size_t length) {
     assert(ls->valid_pos(pos) && "Invalid input: start <= pos <= end");
 
-    std::ostringstream oss;
+    std::string out(length, '\0');
+    out.resize(ls->copy_range(ls->offset_of(pos), length, &out[0]));
+    return out;
+}
 
-    // Copy the substring, move to next LS if needed
-    size_t writen = 0;
-    while (writen < length && ls != NULL) {
-        if (pos <= ls->get_end()) {
-            oss << ls->get_seq_at(pos);
-            pos++;
-            writen++;
+GapSampler::GapSampler(double rate, SampleMode mode)
+    : rate_(rate), mode_(mode),
+      bd_(rate <= 0.0 ? 0.0 : (rate >= 1.0 ? 1.0 : rate)),
+      inv_log_q_(rate <= 0.0 || rate >= 1.0 ? 0.0 : 1.0 / std::log1p(-rate)),
+      used_(BLOCK) {}
+
+void GapSampler::refill(MutationRNG& gen) {
+    double uniforms[BLOCK];
+    rng_fill_uniform(gen, uniforms, BLOCK);
+    for (size_t i = 0; i < BLOCK; i++) {
+        // u in (0, 1], so log(u) <= 0 and the gap is never negative
+        double gap = std::floor(std::log(uniforms[i]) * inv_log_q_);
+        // a gap too large for size_t is past the end of any chromosome anyway
+        gaps_[i] = gap < 1e18 ? static_cast<size_t>(gap) : NO_MUTATION;
+    }
+    used_ = 0;
+}
+
+size_t GapSampler::next(MutationRNG& gen) {
+    if (rate_ <= 0.0) {
+        return NO_MUTATION;
+    }
+    if (rate_ >= 1.0) {
+        return 0;
+    }
+    if (mode_ == SampleMode::GEOMETRIC) {
+        // number of failures before the first success, exactly the skip length
+        STAT_ADD(STAT_RNG_DRAWS, 1);
+        if (used_ == BLOCK) {
+            refill(gen);
+        }
+        return gaps_[used_++];
+    }
+    size_t gap = 0;
+    while (!bd_(gen)) {
+        gap++;
+    }
+    STAT_ADD(STAT_RNG_DRAWS, gap + 1);
+    return gap;
+}
+
+MutationRNG stream_rng(uint64_t seed, uint64_t pass, uint64_t chrom, uint64_t chunk) {
+    std::seed_seq seq = {static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32),
+                         static_cast<uint32_t>(pass),
+                         static_cast<uint32_t>(chrom), static_cast<uint32_t>(chrom >> 32),
+                         static_cast<uint32_t>(chunk), static_cast<uint32_t>(chunk >> 32)};
+    return MutationRNG(seq);
+}
+
+uint64_t haplotype_seed(uint64_t seed, uint64_t h) {
+    uint64_t z = seed + (h + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*
+    Where an event on inserted bases (bases of a Sequence with no id) is recorded: at the last reference
+    base before it (chrom, pos) with INFO ";INSERTED=<k>", k the number of visible inserted bases between
+    that base and the event as the chain stands when the event happens
+    with no reference base before it, at POS 0 of the chromosome with ";INSERTED=<k>;CHROM_START",
+    k counted from the start of the chromosome
+*/
+struct RecordAnchor {
+    const std::string* chrom;
+    size_t pos;
+    size_t inserted;
+    // false until a reference base is met
+    bool found;
+
+    explicit RecordAnchor(const std::string& chromosome) : chrom(&chromosome), pos(0), inserted(0), found(false) {}
+
+    // walk over n visible bases of ls starting offset bases after its visible front
+    void pass(const LinkedSequence* ls, size_t offset, size_t n) {
+        if (n == 0) {
+            return;
+        }
+        const Sequence* seq = ls->get_seq();
+        if (seq->id.empty()) {
+            inserted += n;
         } else {
-            ls = ls->get_next();
-            if (ls == NULL) {
-                break;
+            chrom = &seq->id;
+            pos = ls->seq_pos(offset + n - 1);
+            inserted = 0;
+            found = true;
+        }
+    }
+
+    std::string info() const {
+        return "INSERTED=" + std::to_string(inserted) + (found ? "" : ";CHROM_START");
+    }
+};
+
+/*
+    anchor after the first n visible bases of the chain at head
+*/
+static RecordAnchor walk_anchor(const LinkedSequence* head, size_t n) {
+    RecordAnchor anchor(head->get_seq()->id);
+    for (const LinkedSequence* ls = head; ls != nullptr && n > 0; ls = ls->get_next()) {
+        size_t take = std::min(n, ls->size());
+        anchor.pass(ls, 0, take);
+        n -= take;
+    }
+    return anchor;
+}
+
+/*
+    anchor of visible base pos of rope, searching back piece by piece from pos
+*/
+static RecordAnchor rope_anchor(const SegmentRope& rope, size_t pos, const std::string& chromosome) {
+    RecordAnchor anchor(chromosome);
+    size_t inserted = 0;
+    while (pos > 0) {
+        size_t offset;
+        SegmentRope::Piece piece = rope.locate(pos - 1, &offset);
+        if (!piece.seq->id.empty()) {
+            anchor.chrom = &piece.seq->id;
+            anchor.pos = piece.seq_pos(offset);
+            anchor.found = true;
+            break;
+        }
+        inserted += offset + 1;
+        pos -= offset + 1;
+    }
+    anchor.inserted = inserted;
+    return anchor;
+}
+
+void gen_CNV(std::vector<LinkedSequence*>& linkedseqs,
+             RecordSink& mut_record,
+             const CNVModel& model,
+             uint64_t seed,
+             ThreadPool& workers,
+             SampleMode mode,
+             size_t first_chrom) {
+    assert(model.min_len > 0 && model.min_len <= model.max_len && "Invalid CNV length range");
+
+    // copy number table is shared by every chromosome
+    AliasTable gen_copy(model.copy_prob);
+    std::vector<RecordBuffer> records(linkedseqs.size());
+    parallel_for(workers, linkedseqs.size(), [&](size_t c) {
+        MutationRNG gen = stream_rng(seed, RNG_PASS_CNV, first_chrom + c, 0);
+        GapSampler gaps(model.rate, mode);
+        std::bernoulli_distribution is_amp(model.amp_prob);
+        std::uniform_real_distribution<double> log_len(std::log(static_cast<double>(model.min_len)),
+                                                       std::log(static_cast<double>(model.max_len)));
+
+        LinkedSequence* head = linkedseqs[c];
+        // work in mutated coordinates, every event is O(log n) plus the pieces it touches
+        SegmentRope rope(head);
+        bool changed = false;
+        size_t pos = 0;
+        for (size_t gap = gaps.next(gen); gap < rope.size() - pos; gap = gaps.next(gen)) {
+            pos += gap;
+            size_t len = std::min(static_cast<size_t>(std::exp(log_len(gen))), rope.size() - pos);
+            size_t offset;
+            SegmentRope::Piece first = rope.locate(pos, &offset);
+            size_t ref_pos = first.seq_pos(offset);
+            char ref_base = first.seq->base_at(ref_pos);
+            // after a translocation the piece may come from another chromosome
+            const std::string* cur_chrom = &first.seq->id;
+            std::string len_info = "LEN=" + std::to_string(len);
+            if (cur_chrom->empty()) {
+                // starts on inserted bases (ex. a haplotype over its ancestor's insertions)
+                RecordAnchor anchor = rope_anchor(rope, pos, head->get_seq()->id);
+                cur_chrom = anchor.chrom;
+                ref_pos = anchor.pos;
+                ref_base = rope.get_seq_at(pos);
+                len_info += ";" + anchor.info();
+            }
+
+            if (is_amp(gen)) {
+                size_t copy_number = gen_copy.sample(gen);
+                assert(copy_number >= 2 && "copy_prob must be 0.0 for copy number 0 and 1");
+                // same pieces copy_number - 1 times, pointing at the same bases
+                std::vector<SegmentRope::Piece> region = rope.pieces(pos, len);
+                std::vector<SegmentRope::Piece> copies;
+                copies.reserve(region.size() * (copy_number - 1));
+                for (size_t k = 1; k < copy_number; k++) {
+                    copies.insert(copies.end(), region.begin(), region.end());
+                }
+                rope.insert_pieces(pos + len, copies);
+                records[c].emit(*cur_chrom, ref_pos, std::string(1, ref_base), "<DUP>", MutationType::CNV_AMP,
+                                len_info + ";CN=" + std::to_string(copy_number));
+                // continue after the last copy
+                pos += len * copy_number;
+            } else {
+                rope.delete_section(pos, len);
+                records[c].emit(*cur_chrom, ref_pos, std::string(1, ref_base), "<DEL>", MutationType::CNV_DEL,
+                                len_info + ";CN=0");
             }
-            pos = ls->get_start();
+            changed = true;
+        }
+        if (changed) {
+            rope.to_linked(head);
         }
+    });
+
+    // merge records in chromosome order
+    for (RecordBuffer& chrom_records : records) {
+        mut_record.append(chrom_records);
     }
+}
+
+/*
+    LS first to last (inclusive), linked by next_
+*/
+struct LSRun {
+    LinkedSequence* first;
+    LinkedSequence* last;
+};
 
-    return oss.str();  
+/*
+    return the LS holding visible base pos of the chain at head, and its Sequence position in *seq_pos
+*/
+static const LinkedSequence* locate_base(const LinkedSequence* head, size_t pos, size_t* seq_pos) {
+    const LinkedSequence* ls = head;
+    while (pos >= ls->size()) {
+        pos -= ls->size();
+        ls = ls->get_next();
+        assert(ls != nullptr && "pos past the end of the chain");
+    }
+    *seq_pos = ls->seq_pos(pos);
+    return ls;
 }
 
-void gen_INDEL(std::vector<LinkedSequence*>& linkedseqs,
-               std::ofstream& mut_record,
-               std::vector<double>& ins_prob,
-               std::vector<double>& del_prob,
-               double avg_mut_rate,
-               std::mt19937& gen) {
-    // create a bernoulli distribution to determine mutation or not
-    std::bernoulli_distribution bd(avg_mut_rate);
-    // split 50-50 between insert or delete, can change or pass in as variable if desired
+/*
+    "TO=chrom:pos" for the reference position of visible base pos - 1 of the chain at head,
+    the base a translocated section now follows (the last reference base before it if that one
+    was inserted), "TO=chrom:." if no reference base is before it
+*/
+static std::string translocation_target(const LinkedSequence* head, size_t pos) {
+    RecordAnchor anchor = walk_anchor(head, pos);
+    if (!anchor.found) {
+        return "TO=" + head->get_seq_id() + ":.";
+    }
+    return "TO=" + *anchor.chrom + ":" + std::to_string(anchor.pos);
+}
+
+/*
+    flip the order and orientation of every LS in run, return the new first and last
+    the caller links the result back in
+*/
+static LSRun invert_run(LSRun run) {
+    LinkedSequence* prev = nullptr;
+    LinkedSequence* cur = run.first;
+    while (true) {
+        LinkedSequence* next = cur->get_next();
+        cur->set_next(prev);
+        cur->reverse();
+        if (cur == run.last) {
+            break;
+        }
+        prev = cur;
+        cur = next;
+    }
+    return LSRun{run.last, run.first};
+}
+
+void gen_SV(std::vector<LinkedSequence*>& linkedseqs,
+            RecordSink& mut_record,
+            const SVModel& model,
+            uint64_t seed,
+            SampleMode mode) {
+    assert(model.min_len > 0 && model.min_len <= model.max_len && "Invalid SV length range");
+    assert(model.max_fragments >= 2 && "A balanced rearrangement needs at least 2 fragments");
+
+    // an inter translocation links two chromosomes, so one stream for the whole pass
+    MutationRNG gen = stream_rng(seed, RNG_PASS_SV, 0, 0);
+    GapSampler gaps(model.rate, mode);
+    AliasTable gen_type({model.inv_weight, model.intra_weight, model.inter_weight, model.bal_weight});
+    std::uniform_real_distribution<double> log_len(std::log(static_cast<double>(model.min_len)),
+                                                   std::log(static_cast<double>(model.max_len)));
+    std::uniform_int_distribution<size_t> gen_fragments(2, model.max_fragments);
     std::bernoulli_distribution coinflip(0.5);
-    // distribution for the indel length
-    std::discrete_distribution<size_t> gen_ins_len(ins_prob.begin(), ins_prob.end());
-    std::discrete_distribution<size_t> gen_del_len(del_prob.begin(), del_prob.end());
 
-    // start simulating indel
-    for (LinkedSequence* cur_ls : linkedseqs) {
-        std::string cur_chrom = cur_ls->get_seq_id();
-        while (cur_ls != NULL) {
-            // only mutate on valid positions, notice if ls is_empty it will exit forloop by default
-            for (size_t pos = cur_ls->get_start(); pos <= cur_ls->get_end(); pos++) {
-                if (bd(gen)) {
-                    if (coinflip(gen)) {  // 50-50 for insert of del
-                        // insert
-                        size_t ins_len = gen_ins_len(gen);
-                        // random base insertion (FOR NOW)
-                        std::vector<double> atcg_prob = {0.25, 0.25, 0.25, 0.25};
-                        std::string* data = gen_n_nucleotides(atcg_prob, ins_len, gen);
-                        // ensure newseq.id is empty, so it gets cleaned up by ~LS and hence ~Sequence
-                        Sequence* newseq = new Sequence(std::string(), data);
-                        // write mutation to record
-                        // chrom pos ref alt info
-                        mut_record << cur_chrom << '\t'
-                                   << pos << '\t'
-                                   << cur_ls->get_seq_at(pos) << '\t'
-                                   << *data << '\t'
-                                   << "INS" << std::endl;
-                        // actual mutation
-                        cur_ls->insert_seq(newseq, pos);
-                        // skip over the section we just added
-                        cur_ls = cur_ls->get_next();
-                        break;
-                    } else {
-                        // delete
-                        size_t del_len = gen_del_len(gen);
-                        std::string copy_del_seg = deep_copy_string(cur_ls, pos, del_len);
-                        
-                        // chrom pos ref alt info
-                        mut_record << cur_chrom << '\t'
-                                   << pos << '\t'
-                                   << copy_del_seg << '\t'
-                                   << "." << '\t'
-                                   << "DEL" << std::endl;
-                        // actual mutation
-                        cur_ls->delete_section(pos, del_len);
-                        // over delete is ok since the for loop condition will just skip it
-                        break;
+    // visible bases of each chromosome, kept up to date as tails are swapped
+    std::vector<size_t> lengths;
+    for (LinkedSequence* head : linkedseqs) {
+        size_t len = 0;
+        for (const LinkedSequence* ls = head; ls != nullptr; ls = ls->get_next()) {
+            len += ls->size();
+        }
+        lengths.push_back(len);
+    }
+
+    RecordBuffer records;
+    for (size_t c = 0; c < linkedseqs.size(); c++) {
+        LinkedSequence* head = linkedseqs[c];
+        size_t pos = 0;
+        for (size_t gap = gaps.next(gen); gap < lengths[c] - pos; gap = gaps.next(gen)) {
+            pos += gap;
+            int type = static_cast<int>(gen_type.sample(gen));
+            size_t len = std::min(static_cast<size_t>(std::exp(log_len(gen))), lengths[c] - pos);
+            if (type == 2 && linkedseqs.size() < 2) {
+                // nowhere to translocate to, move it within the chromosome instead
+                type = 1;
+            }
+            if (type == 1 && len == lengths[c]) {
+                // the whole chromosome, moving it is a no-op, invert it instead
+                type = 0;
+            }
+            // reference position of the first base, before anything moves
+            size_t ref_pos;
+            const LinkedSequence* first = locate_base(head, pos, &ref_pos);
+            std::string chrom = first->get_seq_id();
+            std::string ref_base(1, first->get_seq_at(ref_pos));
+            std::string len_info = "LEN=" + std::to_string(len);
+            // INFO of a section starting on inserted bases, recorded at the reference base before them
+            std::string inserted_info;
+            if (chrom.empty()) {
+                RecordAnchor anchor = walk_anchor(head, pos);
+                chrom = *anchor.chrom;
+                ref_pos = anchor.pos;
+                inserted_info = ";" + anchor.info();
+            }
+
+            // always cut at increasing offsets, so before keeps ending at pos
+            LinkedSequence* before = head->cut_after(pos);
+            if (type == 2) {
+                // reciprocal, swap everything after pos with everything after a point of another chromosome
+                std::uniform_int_distribution<size_t> gen_other(0, linkedseqs.size() - 2);
+                size_t o = gen_other(gen);
+                o += o >= c ? 1 : 0;
+                size_t other_pos = std::uniform_int_distribution<size_t>(0, lengths[o])(gen);
+                LinkedSequence* other_before = linkedseqs[o]->cut_after(other_pos);
+                std::string to = translocation_target(linkedseqs[o], other_pos);
+                LinkedSequence* tail = before->get_next();
+                before->set_next(other_before->get_next());
+                other_before->set_next(tail);
+
+                size_t tail_len = lengths[c] - pos;
+                lengths[c] = pos + lengths[o] - other_pos;
+                lengths[o] = other_pos + tail_len;
+                records.emit(chrom, ref_pos, ref_base, "<TRA>", MutationType::SV_TRA,
+                             "LEN=" + std::to_string(tail_len) + ";" + to + inserted_info);
+                // the rest of this chromosome came from o (may be nothing), carry on over it
+                pos = std::min(pos + 1, lengths[c]);
+                continue;
+            }
+
+            LinkedSequence* last = before->cut_after(before->size() + len);
+            LSRun region{before->get_next(), last};
+            LinkedSequence* after = last->get_next();
+            if (type == 0) {
+                LSRun inverted = invert_run(region);
+                before->set_next(inverted.first);
+                inverted.last->set_next(after);
+                records.emit(chrom, ref_pos, ref_base, "<INV>", MutationType::SV_INV, len_info + inserted_info);
+            } else if (type == 1) {
+                // unlink the region, then link it back in after to_pos bases of what is left
+                before->set_next(after);
+                size_t to_pos = std::uniform_int_distribution<size_t>(0, lengths[c] - len)(gen);
+                LinkedSequence* dest = head->cut_after(to_pos);
+                region.last->set_next(dest->get_next());
+                dest->set_next(region.first);
+                records.emit(chrom, ref_pos, ref_base, "<TRA>", MutationType::SV_TRA,
+                             len_info + ";" + translocation_target(head, to_pos) + inserted_info);
+            } else {
+                // cut into fragments at sorted random offsets, fragments[i] ends at cuts[i]
+                size_t n = std::min(gen_fragments(gen), len);
+                std::vector<size_t> cuts;
+                while (cuts.size() + 1 < n) {
+                    cuts.push_back(std::uniform_int_distribution<size_t>(1, len - 1)(gen));
+                }
+                std::sort(cuts.begin(), cuts.end());
+                cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+                cuts.push_back(len);
+
+                std::vector<LSRun> fragments;
+                LinkedSequence* prev = before;
+                for (size_t cut : cuts) {
+                    LinkedSequence* end = before->cut_after(before->size() + cut);
+                    fragments.push_back(LSRun{prev->get_next(), end});
+                    prev = end;
+                }
+                std::shuffle(fragments.begin(), fragments.end(), gen);
+                std::string order;
+                LinkedSequence* link = before;
+                for (LSRun& fragment : fragments) {
+                    if (coinflip(gen)) {
+                        fragment = invert_run(fragment);
                     }
+                    link->set_next(fragment.first);
+                    link = fragment.last;
+                }
+                link->set_next(after);
+                records.emit(chrom, ref_pos, ref_base, "<BAL>", MutationType::SV_BAL,
+                             len_info + ";FRAGMENTS=" + std::to_string(fragments.size()) + inserted_info);
+            }
+            pos += len;
+        }
+    }
+    mut_record.append(records);
+}
+
+/*
+    draw the substitute of ref_base from tables (one per A, T, C, G, index_to_nucleotide order)
+    soft masked bases mutate like upper case ones and stay lower case
+    return '\0' for N and other IUPAC codes, they have no base to substitute
+*/
+static char draw_snp_base(char ref_base, const AliasTable* const tables[4], MutationRNG& gen) {
+    int row;
+    switch (toupper(ref_base)) {
+        case 'A': row = 0; break;
+        case 'T': row = 1; break;
+        case 'C': row = 2; break;
+        case 'G': row = 3; break;
+        default: return '\0';
+    }
+    char new_base = index_to_nucleotide(static_cast<int>(tables[row]->sample(gen)));
+    STAT_ADD(STAT_RNG_DRAWS, 1);
+    if (islower(ref_base)) {
+        new_base = static_cast<char>(tolower(new_base));
+    }
+    assert(ref_base != new_base);
+    return new_base;
+}
+
+/*
+    One unit of work of a chunked pass over the LS chains: chunk number chunk of chromosome chrom,
+    the LS from first up to (not including) stop
+*/
+struct ChainChunk {
+    size_t chrom;
+    size_t chunk;
+    LinkedSequence* first;
+    const LinkedSequence* stop;
+};
+
+/*
+    cut every chain into chunks of chunk_bases visible bases (LinkedSequence::split_chunks), in chain order
+*/
+static std::vector<ChainChunk> cut_chunks(std::vector<LinkedSequence*>& linkedseqs, size_t chunk_bases) {
+    std::vector<ChainChunk> units;
+    for (size_t c = 0; c < linkedseqs.size(); c++) {
+        std::vector<LinkedSequence*> chunks = linkedseqs[c]->split_chunks(chunk_bases);
+        for (size_t k = 0; k < chunks.size(); k++) {
+            units.push_back(ChainChunk{c, k, chunks[k], k + 1 < chunks.size() ? chunks[k + 1] : nullptr});
+        }
+    }
+    return units;
+}
+
+/*
+    Record of a chunk held back until the chunks before it are done, see ChunkRecords
+    at_start: an event on inserted bases before the chunk's first reference base, recorded at the anchor
+    of the chunk's start plus inserted more inserted bases, chrom/pos/info are used as is otherwise
+*/
+struct PendingRecord {
+    bool at_start;
+    size_t inserted;
+    const std::string* chrom;
+    size_t pos;
+    std::string ref;
+    std::string alt;
+    MutationType type;
+    std::string info;
+};
+
+/*
+    Records of one chunk of a chunked pass
+    an event on inserted bases before the chunk's first reference base is anchored in the chunk before,
+    which another worker may still be mutating, so it and every record after it wait in pending
+    until merge_chunk_records, once every chunk is done, records keep the ones before it
+*/
+struct ChunkRecords {
+    RecordBuffer records;
+    std::vector<PendingRecord> pending;
+
+    // record at a reference position
+    void emit(const std::string& chrom, size_t pos, const char* ref, size_t ref_len,
+              const char* alt, size_t alt_len, MutationType type, const std::string& info = std::string()) {
+        if (pending.empty()) {
+            records.emit(chrom, pos, ref, ref_len, alt, alt_len, type, info);
+        } else {
+            pending.push_back(PendingRecord{false, 0, &chrom, pos, std::string(ref, ref_len),
+                                            std::string(alt, alt_len), type, info});
+        }
+    }
+
+    // record an event on inserted bases where the walk's anchor says
+    void emit_inserted(const RecordAnchor& anchor, const char* ref, size_t ref_len,
+                       const char* alt, size_t alt_len, MutationType type) {
+        if (anchor.found) {
+            emit(*anchor.chrom, anchor.pos, ref, ref_len, alt, alt_len, type, anchor.info());
+        } else {
+            pending.push_back(PendingRecord{true, anchor.inserted, nullptr, 0, std::string(ref, ref_len),
+                                            std::string(alt, alt_len), type, std::string()});
+        }
+    }
+};
+
+/*
+    write the records of every chunk in chunk order, independent of which thread finished first
+    pending records get their anchor from a walk over the chain up to the chunk's first LS, every chunk
+    is done so the bases before it are final, the walk only moves forward over all chunks of the pass
+*/
+static void merge_chunk_records(const std::vector<LinkedSequence*>& linkedseqs, const std::vector<ChainChunk>& units,
+                                std::vector<ChunkRecords>& chunks, RecordSink& mut_record) {
+    if (units.empty()) {
+        return;
+    }
+    size_t chrom = units[0].chrom;
+    const LinkedSequence* walked = linkedseqs[chrom];
+    RecordAnchor anchor(linkedseqs[chrom]->get_seq()->id);
+    for (size_t i = 0; i < units.size(); i++) {
+        ChunkRecords& chunk = chunks[i];
+        // records came before the first pending one
+        mut_record.append(chunk.records);
+        if (!chunk.pending.empty()) {
+            if (units[i].chrom != chrom) {
+                chrom = units[i].chrom;
+                walked = linkedseqs[chrom];
+                anchor = RecordAnchor(linkedseqs[chrom]->get_seq()->id);
+            }
+            for (; walked != units[i].first; walked = walked->get_next()) {
+                assert(walked != nullptr && "chunk start not in its chain");
+                anchor.pass(walked, 0, walked->size());
+            }
+            RecordBuffer resolved;
+            for (const PendingRecord& record : chunk.pending) {
+                if (record.at_start) {
+                    RecordAnchor at = anchor;
+                    at.inserted += record.inserted;
+                    resolved.emit(*at.chrom, at.pos, record.ref, record.alt, record.type, at.info());
+                } else {
+                    resolved.emit(*record.chrom, record.pos, record.ref, record.alt, record.type, record.info);
                 }
             }
-            if (cur_ls != NULL) {
-                cur_ls = cur_ls->get_next();
+            mut_record.append(resolved);
+        }
+    }
+}
+
+/*
+    record an insertion of bases right before the visible base at pos of ls (see insert_bases), in reference
+    orientation: on a reversed LS the bases sit between pos and pos + 1 of the forward strand, so ALT is their
+    reverse complement and the record goes at pos + 1 (REF "." if pos is the last base of the Sequence)
+    a base of an inserted Sequence goes at anchor, as the walk sees it
+    alt is scratch space, reused so it doesn't allocate once it has grown
+*/
+static void record_insertion(ChunkRecords& records, const RecordAnchor& anchor, const LinkedSequence* ls,
+                             size_t pos, const std::string& bases, std::string& alt) {
+    Sequence* seq = ls->get_seq();
+    if (seq->id.empty()) {
+        char base = ls->get_seq_at(pos);
+        records.emit_inserted(anchor, &base, 1, bases.data(), bases.size(), MutationType::INS);
+        return;
+    }
+    alt.assign(bases);
+    if (ls->is_reversed()) {
+        reverse_complement(&alt[0], alt.size());
+        pos++;
+    }
+    char ref_base = pos < seq->size() ? seq->base_at(pos) : '.';
+    records.emit(seq->id, pos, &ref_base, 1, alt.data(), alt.size(), MutationType::INS);
+}
+
+/*
+    record the deletion of n visible bases starting offset bases after the visible front of ls,
+    before it is applied, in reference orientation: one record per piece that is contiguous on the
+    forward strand of one Sequence, at the piece's lowest position with its forward bases
+    so a deletion over a reversed LS or across a CNV/SV junction still reads like the reference at POS
+    a run of inserted bases goes at anchor (the base before the deletion) as the walk sees it
+    ref is scratch space like record_insertion's alt
+*/
+static void record_deletion(ChunkRecords& records, const RecordAnchor& anchor, const LinkedSequence* ls,
+                            size_t offset, size_t n, std::string& ref) {
+    SpanIterator spans(ls, offset, n);
+    BaseSpan span;
+    BaseSpan piece{};
+    bool open = false;
+    ref.clear();
+    auto flush = [&]() {
+        if (piece.seq->id.empty()) {
+            records.emit_inserted(anchor, ref.data(), ref.size(), ".", 1, MutationType::DEL);
+        } else {
+            // the visible bases of a reversed piece read back to front
+            if (piece.reversed) {
+                reverse_complement(&ref[0], ref.size());
+            }
+            records.emit(piece.seq->id, piece.pos, ref.data(), ref.size(), ".", 1, MutationType::DEL);
+        }
+        ref.clear();
+    };
+    while (spans.next(span)) {
+        bool inserted = span.seq->id.empty();
+        // a reversed piece grows towards lower positions, its visible back is its lowest base
+        bool extends = open && (inserted ? piece.seq->id.empty() :
+                                span.seq == piece.seq && span.reversed == piece.reversed &&
+                                (span.reversed ? span.pos + span.len == piece.pos : piece.pos + piece.len == span.pos));
+        if (!extends) {
+            if (open) {
+                flush();
             }
+            piece = span;
+            open = true;
+        } else if (!inserted) {
+            piece.pos = std::min(piece.pos, span.pos);
+            piece.len += span.len;
         }
+        size_t at = ref.size();
+        ref.resize(at + span.len);
+        span.seq->copy_bases(span.pos, span.len, &ref[at]);
+        if (span.reversed) {
+            reverse_complement(&ref[at], span.len);
+        }
+    }
+    if (open) {
+        flush();
+    }
+}
+
+/*
+    Generate indel on the LS from cur_ls up to (not including) stop
+    left is the number of visible bases in that range, deletions are cut short at stop
+    chrom is the id of the chromosome, events on inserted bases are recorded at the last reference base before them
+*/
+static void gen_INDEL_chunk(LinkedSequence* cur_ls,
+                            const LinkedSequence* stop,
+                            const std::string& chrom,
+                            ChunkRecords& records,
+                            const AliasTable& gen_ins_len,
+                            const AliasTable& gen_del_len,
+                            const AliasTable& gen_base,
+                            GapSampler& gaps,
+                            MutationRNG& gen) {
+    // split 50-50 between insert or delete, can change or pass in as variable if desired
+    std::bernoulli_distribution coinflip(0.5);
+    // bases of the current insertion and the record's REF/ALT, reused so neither allocates once it has grown
+    std::string ins_bases;
+    std::string record_bases;
+
+    // visible bases from the start of cur_ls to stop
+    size_t left = 0;
+    for (const LinkedSequence* ls = cur_ls; ls != stop; ls = ls->get_next()) {
+        left += ls->size();
     }
+    // last reference base walked over, inserted bases (ex. a haplotype's ancestor's) are recorded there
+    RecordAnchor anchor(chrom);
+
+    // bases left to skip before the next mutation, carried over across LS
+    size_t gap = gaps.next(gen);
+    while (cur_ls != stop) {
+        // skip over whole LS that the gap jumps past, empty LS are skipped by default
+        if (gap >= cur_ls->size()) {
+            if (gap != GapSampler::NO_MUTATION) {
+                gap -= cur_ls->size();
+            }
+            anchor.pass(cur_ls, 0, cur_ls->size());
+            left -= cur_ls->size();
+            cur_ls = cur_ls->get_next();
+            continue;
+        }
+        size_t pos = cur_ls->seq_pos(gap);
+        anchor.pass(cur_ls, 0, gap);
+        left -= gap;
+        // coin flip and length
+        STAT_ADD(STAT_RNG_DRAWS, 2);
+        if (coinflip(gen)) {  // 50-50 for insert of del
+            // insert
+            size_t ins_len = gen_ins_len.sample(gen);
+            STAT_ADD(STAT_RNG_DRAWS, ins_len);
+            gen_n_nucleotides(gen_base, ins_len, gen, ins_bases);
+            // write mutation to record, after a translocation the LS may come from another chromosome
+            record_insertion(records, anchor, cur_ls, pos, ins_bases, record_bases);
+            // actual mutation, the bases go to the insertion Sequence of the chunk's pool
+            // continue from the LS after the inserted section, the new bases sit between the anchor and pos
+            cur_ls = cur_ls->insert_bases(ins_bases.data(), ins_len, pos);
+            anchor.inserted += ins_len;
+        } else {
+            // delete, over delete is cut short at the end of the chunk
+            size_t del_len = std::min(gen_del_len.sample(gen), left);
+            record_deletion(records, anchor, cur_ls, gap, del_len, record_bases);
+            // actual mutation, continue from the LS after the deleted section
+            cur_ls = cur_ls->delete_section(pos, del_len);
+            left -= del_len;
+            if (cur_ls == NULL) {
+                break;
+            }
+        }
+        gap = gaps.next(gen);
+    }
+}
+
+void gen_INDEL(std::vector<LinkedSequence*>& linkedseqs,
+               RecordSink& mut_record,
+               std::vector<double>& ins_prob,
+               std::vector<double>& del_prob,
+               std::vector<double>& ins_base_prob,
+               double avg_mut_rate,
+               uint64_t seed,
+               ThreadPool& workers,
+               SampleMode mode,
+               size_t chunk_bases,
+               size_t first_chrom) {
+    // one unit of work per (chromosome, chunk), cut up front on this thread
+    std::vector<ChainChunk> units = cut_chunks(linkedseqs, chunk_bases);
+
+    // every distribution is built once and only read by the chunks
+    AliasTable gen_ins_len(ins_prob);
+    AliasTable gen_del_len(del_prob);
+    AliasTable gen_base(ins_base_prob);
+
+    // start simulating indel
+    std::vector<ChunkRecords> records(units.size());
+    parallel_for(workers, units.size(), [&](size_t i) {
+        const ChainChunk& unit = units[i];
+        MutationRNG gen = stream_rng(seed, RNG_PASS_INDEL, first_chrom + unit.chrom, unit.chunk);
+        // gap to the next mutated base, replaces one bernoulli draw per base
+        GapSampler gaps(avg_mut_rate, mode);
+        gen_INDEL_chunk(unit.first, unit.stop, linkedseqs[unit.chrom]->get_seq()->id, records[i],
+                        gen_ins_len, gen_del_len, gen_base, gaps, gen);
+    });
+
+    merge_chunk_records(linkedseqs, units, records, mut_record);
 }
 
 void gen_SNP(std::vector<Sequence*>& sequences, 
-             std::ofstream& mut_record,
+             RecordSink& mut_record,
              std::vector<std::vector<double>>& snp_prob,
              double avg_mut_rate,
-             std::mt19937& gen) {
+             uint64_t seed,
+             ThreadPool& workers,
+             SampleMode mode,
+             size_t chunk_bases,
+             SnpOverlay* snps,
+             size_t first_chrom) {
     assert(snp_prob.size() == 4 && "SNP prob needs to be 4");
-    // create a bernoulli distribution to determine mutation or not
-    std::bernoulli_distribution bd(avg_mut_rate);
-    // create individual mutation distribution for each ATCG
-    std::discrete_distribution<size_t> mut_A(snp_prob[0].begin(), snp_prob[0].end());
-    std::discrete_distribution<size_t> mut_T(snp_prob[1].begin(), snp_prob[1].end());
-    std::discrete_distribution<size_t> mut_C(snp_prob[2].begin(), snp_prob[2].end());
-    std::discrete_distribution<size_t> mut_G(snp_prob[3].begin(), snp_prob[3].end());
-
-
-    for (Sequence* cur_seq : sequences) {
-        std::string cur_chrom = cur_seq->id;
-        for (size_t pos = 0; pos < cur_seq->data->size(); pos++) {
-            if (bd(gen)) {
-                // a snp mutation occur at cur_seq[pos]
-                char ref_base = cur_seq->data->at(pos);
-                char new_base = '\0';
-                switch (ref_base) {
-                    case 'A': new_base = index_to_nucleotide(mut_A(gen)); break;
-                    case 'T': new_base = index_to_nucleotide(mut_T(gen)); break;
-                    case 'C': new_base = index_to_nucleotide(mut_C(gen)); break;
-                    case 'G': new_base = index_to_nucleotide(mut_G(gen)); break;
+
+    // one unit of work per (chromosome, chunk of chunk_bases)
+    struct Unit {
+        size_t chrom;
+        size_t chunk;
+        size_t begin;
+        size_t end;
+    };
+    std::vector<Unit> units;
+    for (size_t c = 0; c < sequences.size(); c++) {
+        size_t len = sequences[c]->size();
+        size_t step = chunk_bases == 0 ? len : chunk_bases;
+        for (size_t k = 0, begin = 0; begin < len; k++, begin += step) {
+            units.push_back(Unit{c, k, begin, std::min(len, begin + step)});
+        }
+    }
+
+    // individual mutation distribution for each ATCG, shared by every chunk
+    AliasTable mut_A(snp_prob[0]);
+    AliasTable mut_T(snp_prob[1]);
+    AliasTable mut_C(snp_prob[2]);
+    AliasTable mut_G(snp_prob[3]);
+    const AliasTable* mut_tables[4] = {&mut_A, &mut_T, &mut_C, &mut_G};
+
+    std::vector<RecordBuffer> records(units.size());
+    // new bases of each unit when writing to snps, merged in unit order so they stay sorted
+    std::vector<std::vector<SnpOverlay::Snp>> changed(snps != nullptr ? units.size() : 0);
+    parallel_for(workers, units.size(), [&](size_t i) {
+        const Unit& unit = units[i];
+        MutationRNG gen = stream_rng(seed, RNG_PASS_SNP, first_chrom + unit.chrom, unit.chunk);
+        // gap to the next mutated base, replaces one bernoulli draw per base
+        GapSampler gaps(avg_mut_rate, mode);
+
+        Sequence* cur_seq = sequences[unit.chrom];
+        assert((cur_seq->data != nullptr || cur_seq->packed != nullptr) &&
+               "Sequence must be materialized before gen_SNP");
+        size_t pos = unit.begin;
+        // jump straight to the next mutated base instead of testing every base
+        for (size_t gap = gaps.next(gen); gap < unit.end - pos; gap = gaps.next(gen)) {
+            pos += gap;
+            // a snp mutation occur at cur_seq[pos]
+            char ref_base = cur_seq->base_at(pos);
+            char new_base = draw_snp_base(ref_base, mut_tables, gen);
+            if (new_base == '\0') {
+                // N and other IUPAC codes have no base to substitute, the draw is spent
+                pos++;
+                continue;
+            }
+
+            // actual mutation
+            if (snps != nullptr) {
+                changed[i].push_back(SnpOverlay::Snp{pos, new_base});
+            } else {
+                cur_seq->set_base(pos, new_base);
+            }
+
+            // chrom pos ref alt info
+            records[i].emit(cur_seq->id, pos, ref_base, new_base, MutationType::SNP);
+            pos++;
+        }
+    });
+
+    // merge records in chunk order, independent of which thread finished first
+    for (RecordBuffer& chunk_records : records) {
+        mut_record.append(chunk_records);
+    }
+    for (size_t i = 0; i < changed.size(); i++) {
+        snps->append(sequences[units[i].chrom], changed[i]);
+    }
+}
+
+/*
+    SNP of gen_SNP_INDEL, written into its Sequence once every chunk is done
+    base is in the orientation of the Sequence
+*/
+struct SnpChange {
+    Sequence* seq;
+    size_t pos;
+    char base;
+};
+
+/*
+    Models shared by every chunk of gen_SNP_INDEL, built once per call
+*/
+struct SmallMutationTables {
+    AliasTable ins_len;
+    AliasTable del_len;
+    AliasTable ins_base;
+    const AliasTable* snp[4];
+    // 64 random bits below snp_cut pick a SNP, below ins_cut an insertion, a deletion otherwise
+    uint64_t snp_cut;
+    uint64_t ins_cut;
+};
+
+/*
+    Generate SNP, insertions and deletions on the LS from cur_ls up to (not including) stop in one walk
+    chrom is the id of the chromosome, records are in reference orientation like gen_INDEL_chunk's and
+    events on inserted bases are recorded at the last reference base before them
+    SNP go to changes, deletions are cut short at stop
+*/
+static void gen_SNP_INDEL_chunk(LinkedSequence* cur_ls,
+                                const LinkedSequence* stop,
+                                const std::string& chrom,
+                                ChunkRecords& records,
+                                std::vector<SnpChange>& changes,
+                                const SmallMutationTables& tables,
+                                GapSampler& gaps,
+                                MutationRNG& gen) {
+    std::string ins_bases;
+    std::string record_bases;
+
+    // visible bases from the start of cur_ls to stop
+    size_t left = 0;
+    for (const LinkedSequence* ls = cur_ls; ls != stop; ls = ls->get_next()) {
+        left += ls->size();
+    }
+    // last reference base walked over, inserted bases are recorded there
+    RecordAnchor anchor(chrom);
+
+    // bases left to skip before the next event, carried over across LS
+    size_t gap = gaps.next(gen);
+    // visible bases of cur_ls already walked over
+    size_t done = 0;
+    while (cur_ls != stop) {
+        size_t avail = cur_ls->size() - done;
+        if (gap >= avail) {
+            if (gap != GapSampler::NO_MUTATION) {
+                gap -= avail;
+            }
+            anchor.pass(cur_ls, done, avail);
+            left -= avail;
+            cur_ls = cur_ls->get_next();
+            done = 0;
+            continue;
+        }
+        Sequence* seq = cur_ls->get_seq();
+        size_t offset = done + gap;
+        size_t pos = cur_ls->seq_pos(offset);
+        anchor.pass(cur_ls, done, gap);
+        left -= gap;
+        done = offset;
+        // one draw picks the event type
+        STAT_ADD(STAT_RNG_DRAWS, 1);
+        uint64_t pick = rng_bits64(gen);
+        if (pick < tables.snp_cut) {
+            // drawn on the visible base, so the substitution matrix applies to the strand the walk reads
+            char ref_base = cur_ls->get_seq_at(pos);
+            char new_base = draw_snp_base(ref_base, tables.snp, gen);
+            // N and other IUPAC codes have no base to substitute, the draw is spent
+            if (new_base != '\0') {
+                char seq_base = cur_ls->is_reversed() ? complement_base(new_base) : new_base;
+                changes.push_back(SnpChange{seq, pos, seq_base});
+                if (seq->id.empty()) {
+                    records.emit_inserted(anchor, &ref_base, 1, &new_base, 1, MutationType::SNP);
+                } else {
+                    // forward strand, like gen_SNP
+                    char seq_ref = seq->base_at(pos);
+                    records.emit(seq->id, pos, &seq_ref, 1, &seq_base, 1, MutationType::SNP);
                 }
-                assert(ref_base != new_base && new_base != '\0');
+            }
+            anchor.pass(cur_ls, offset, 1);
+            done++;
+            left--;
+        } else if (pick < tables.ins_cut) {
+            STAT_ADD(STAT_RNG_DRAWS, 1);
+            size_t ins_len = tables.ins_len.sample(gen);
+            STAT_ADD(STAT_RNG_DRAWS, ins_len);
+            gen_n_nucleotides(tables.ins_base, ins_len, gen, ins_bases);
+            record_insertion(records, anchor, cur_ls, pos, ins_bases, record_bases);
+            // continue from the LS after the inserted section like gen_INDEL_chunk, walking through the new
+            // bases would let insertions feed the walk faster than it moves on
+            cur_ls = cur_ls->insert_bases(ins_bases.data(), ins_len, pos);
+            anchor.inserted += ins_len;
+            done = 0;
+        } else {
+            STAT_ADD(STAT_RNG_DRAWS, 1);
+            size_t del_len = std::min(tables.del_len.sample(gen), left);
+            record_deletion(records, anchor, cur_ls, offset, del_len, record_bases);
+            cur_ls = cur_ls->delete_section(pos, del_len);
+            done = 0;
+            left -= del_len;
+            if (cur_ls == NULL) {
+                break;
+            }
+        }
+        gap = gaps.next(gen);
+    }
+}
+
+void gen_SNP_INDEL(std::vector<LinkedSequence*>& linkedseqs,
+                   RecordSink& mut_record,
+                   const std::vector<double>& ins_prob,
+                   const std::vector<double>& del_prob,
+                   const std::vector<double>& ins_base_prob,
+                   double indel_rate,
+                   const std::vector<std::vector<double>>& snp_prob,
+                   double snp_rate,
+                   uint64_t seed,
+                   ThreadPool& workers,
+                   SampleMode mode,
+                   size_t chunk_bases,
+                   SnpOverlay* snps,
+                   size_t first_chrom) {
+    assert(snp_prob.size() == 4 && "SNP prob needs to be 4");
+    indel_rate = std::max(indel_rate, 0.0);
+    snp_rate = std::max(snp_rate, 0.0);
+
+    // one unit of work per (chromosome, chunk), cut up front on this thread
+    std::vector<ChainChunk> units = cut_chunks(linkedseqs, chunk_bases);
+
+    // every distribution is built once and only read by the chunks
+    AliasTable mut_A(snp_prob[0]);
+    AliasTable mut_T(snp_prob[1]);
+    AliasTable mut_C(snp_prob[2]);
+    AliasTable mut_G(snp_prob[3]);
+    double rate = indel_rate + snp_rate;
+    // SNP with probability snp_share, the rest split 50-50 between insertion and deletion like gen_INDEL
+    double snp_share = rate > 0.0 ? snp_rate / rate : 0.0;
+    auto cut = [](double p) { return p >= 1.0 ? UINT64_MAX : static_cast<uint64_t>(std::ldexp(p, 64)); };
+    SmallMutationTables tables{AliasTable(ins_prob), AliasTable(del_prob), AliasTable(ins_base_prob),
+                               {&mut_A, &mut_T, &mut_C, &mut_G},
+                               cut(snp_share), cut(snp_share + (1.0 - snp_share) / 2)};
 
-                // actual mutation
-                cur_seq->data->at(pos) = new_base;
+    std::vector<ChunkRecords> records(units.size());
+    std::vector<std::vector<SnpChange>> changes(units.size());
+    parallel_for(workers, units.size(), [&](size_t i) {
+        const ChainChunk& unit = units[i];
+        MutationRNG gen = stream_rng(seed, RNG_PASS_SNP_INDEL, first_chrom + unit.chrom, unit.chunk);
+        GapSampler gaps(rate, mode);
+        // room for the SNP a chunk expects, so the list doesn't regrow while walking
+        changes[i].reserve(static_cast<size_t>(snp_rate * chunk_bases * 1.1));
+        gen_SNP_INDEL_chunk(unit.first, unit.stop, linkedseqs[unit.chrom]->get_seq()->id, records[i], changes[i],
+                            tables, gaps, gen);
+    });
 
-                // chrom pos ref alt info
-                mut_record << cur_chrom << '\t'
-                           << pos << '\t'
-                           << ref_base << '\t'
-                           << new_base << '\t'
-                           << "SNP" << std::endl;
+    merge_chunk_records(linkedseqs, units, records, mut_record);
+    // a base may be hit through several LS (CNV copies), the last SNP in chromosome order wins
+    if (snps == nullptr) {
+        for (const std::vector<SnpChange>& chunk_changes : changes) {
+            for (const SnpChange& change : chunk_changes) {
+                change.seq->set_base(change.pos, change.base);
             }
         }
+        return;
     }
-}
\ No newline at end of file
+    // the overlay takes the SNP of one Sequence sorted by position
+    std::vector<SnpChange> all;
+    for (const std::vector<SnpChange>& chunk_changes : changes) {
+        all.insert(all.end(), chunk_changes.begin(), chunk_changes.end());
+    }
+    std::stable_sort(all.begin(), all.end(), [](const SnpChange& a, const SnpChange& b) {
+        return a.seq != b.seq ? std::less<const Sequence*>()(a.seq, b.seq) : a.pos < b.pos;
+    });
+    std::vector<SnpOverlay::Snp> list;
+    for (size_t i = 0; i < all.size(); i++) {
+        if (i + 1 < all.size() && all[i + 1].seq == all[i].seq && all[i + 1].pos == all[i].pos) {
+            continue;
+        }
+        list.push_back(SnpOverlay::Snp{all[i].pos, all[i].base});
+        if (i + 1 == all.size() || all[i + 1].seq != all[i].seq) {
+            snps->append(all[i].seq, list);
+            list.clear();
+        }
+    }
+}
@@ -1,43 +1,266 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cassert>
+#include <cstdint>
+#include <random>
+
+#include "aliasTable.h"
 #include "linkedSequence.h"
+#include "rng.h"
+#include "snpOverlay.h"
+#include "threadPool.h"
+
+/*
+    How mutated positions are picked
+    BERNOULLI: one coin flip per base, the original behavior
+    GEOMETRIC: draw the gap to the next mutated base from a geometric distribution,
+               same per-base mutation statistics but only one draw per mutation
+*/
+enum class SampleMode {
+    BERNOULLI,
+    GEOMETRIC
+};
+
+/*
+    Mutation passes and the read simulator, each (pass, chromosome, chunk) draws from its own RNG stream
+*/
+enum RngPass : uint64_t {
+    RNG_PASS_INDEL = 1,
+    RNG_PASS_SNP = 2,
+    RNG_PASS_CNV = 3,
+    RNG_PASS_SV = 4,
+    RNG_PASS_READS = 5,
+    RNG_PASS_SNP_INDEL = 6
+};
+
+// bases per unit of parallel work, fixed so the output doesn't depend on the thread count
+constexpr size_t DEFAULT_CHUNK_BASES = 1 << 22;
+
+/*
+    return a MutationRNG (rng.h) seeded from (seed, pass, chrom, chunk)
+    every unit of work gets an independent stream, so results are the same for a given seed
+    no matter which thread runs which unit
+*/
+MutationRNG stream_rng(uint64_t seed, uint64_t pass, uint64_t chrom, uint64_t chunk);
+
+/*
+    return the seed of haplotype h derived from seed (splitmix64), so every haplotype gets
+    its own mutations but the whole run still only depends on seed
+*/
+uint64_t haplotype_seed(uint64_t seed, uint64_t h);
+
+/*
+    Parameters of the CNV pass
+    rate: probability that a CNV starts at each base
+    amp_prob: probability that a CNV is an amplification, deletion otherwise
+    min_len/max_len: CNV length is log-uniform in [min_len, max_len]
+    copy_prob: weight of each total copy number of an amplified region, index is the copy number
+               so index 0 and 1 must be 0.0, does NOT need to sum to 1
+*/
+struct CNVModel {
+    double rate;
+    double amp_prob;
+    size_t min_len;
+    size_t max_len;
+    std::vector<double> copy_prob;
+};
+
+/*
+    Generate CNV over each chromosome, chromosomes run in parallel on workers
+    an amplified region is followed by copy number - 1 tandem copies, each copy is new LS pointing
+    into the same Sequence data, so no base is ever copied, deleted regions are just unlinked
+    positions in the record are reference positions, ALT is <DUP>/<DEL> and INFO has LEN and CN,
+    a region starting on inserted bases is recorded like gen_INDEL's events on them (INFO ";INSERTED=<k>")
+    linkedseqs[i] is chromosome first_chrom + i, which picks its RNG stream
+*/
+void gen_CNV(std::vector<LinkedSequence*>& linkedseqs,
+             RecordSink& mut_record,
+             const CNVModel& model,
+             uint64_t seed,
+             ThreadPool& workers,
+             SampleMode mode = SampleMode::GEOMETRIC,
+             size_t first_chrom = 0);
+
+/*
+    Parameters of the SV pass
+    rate: probability that a SV starts at each base
+    inv_weight/intra_weight/inter_weight/bal_weight: relative weight of inversions, translocations
+        within a chromosome, reciprocal translocations between chromosomes and balanced rearrangements
+    min_len/max_len: SV length is log-uniform in [min_len, max_len]
+    max_fragments: a balanced rearrangement shuffles 2 to max_fragments pieces of its region
+*/
+struct SVModel {
+    double rate;
+    double inv_weight;
+    double intra_weight;
+    double inter_weight;
+    double bal_weight;
+    size_t min_len;
+    size_t max_len;
+    size_t max_fragments;
+};
+
+/*
+    Generate SV over each chromosome, only by relinking LS, no base is ever copied or moved
+    inversion: the LS of the region are relinked in reverse order and each one is flipped (LS::reverse)
+    translocation: the region is unlinked and linked back in at another position of the chromosome
+    inter translocation: the tails of two chromosomes after a breakpoint each are swapped
+    balanced: the region is cut into fragments that are shuffled and randomly inverted
+    positions in the record are reference positions, ALT is <INV>/<TRA>/<BAL> and INFO has LEN
+    translocations add TO=chrom:pos, the reference base the section now follows ("." for none),
+    a section starting on inserted bases is recorded like gen_INDEL's events on them (INFO ";INSERTED=<k>")
+
+    runs on the calling thread, an inter translocation touches two chromosomes
+*/
+void gen_SV(std::vector<LinkedSequence*>& linkedseqs,
+            RecordSink& mut_record,
+            const SVModel& model,
+            uint64_t seed,
+            SampleMode mode = SampleMode::GEOMETRIC);
 
 /*
     Generate indel at each base with prob avg_mut_rate
     objects are always pass by reference, this method shouldn't modify any of the vectors
+    ins_prob/del_prob are length weights, ins_base_prob the weights of inserted ATCG, each is
+    built into an AliasTable once per call and shared by every chunk
+
+    each chromosome is cut into chunks of chunk_bases, chunks are mutated in parallel on workers
+    (a deletion never runs past the end of its chunk) and records are written in chunk order
+    records are on the forward strand of the reference: INS puts ALT right before the base at POS,
+    on an inverted LS it is the reverse complement, a DEL is cut into one record per run of deleted
+    bases that is contiguous in the reference (REF reads like the reference at POS)
+    an event on inserted bases (ex. a haplotype's ancestor's) goes at the last reference base before them
+    with INFO ";INSERTED=<k>", k the number of inserted bases between that base and the event
+    (";INSERTED=<k>;CHROM_START" at POS 0 if no reference base is before them), REF/ALT as they read there
+    linkedseqs[i] is chromosome first_chrom + i, so one chromosome at a time gives the same result
 */
 void gen_INDEL(std::vector<LinkedSequence*>& linkedseqs,
-               std::ofstream& mut_record,
+               RecordSink& mut_record,
                std::vector<double>& ins_prob,
                std::vector<double>& del_prob,
+               std::vector<double>& ins_base_prob,
                double avg_mut_rate,
-               std::mt19937& gen);
+               uint64_t seed,
+               ThreadPool& workers,
+               SampleMode mode = SampleMode::GEOMETRIC,
+               size_t chunk_bases = DEFAULT_CHUNK_BASES,
+               size_t first_chrom = 0);
 
 /*
     directly modify the base pair data within sequence
     objects are always pass by reference, this method shouldn't modify any of the vectors
+
+    sequences must already be materialized, chunks are mutated in parallel on workers
+    and records are written in chunk order, each row of snp_prob is built into an AliasTable once
+    if snps is given the new bases go there instead and sequences are left untouched
+    sequences[i] is chromosome first_chrom + i, same as gen_INDEL
 */
 void gen_SNP(std::vector<Sequence*>& sequences, 
-             std::ofstream& mut_record,
+             RecordSink& mut_record,
              std::vector<std::vector<double>>& snp_prob,
              double avg_mut_rate,
-             std::mt19937& gen);
+             uint64_t seed,
+             ThreadPool& workers,
+             SampleMode mode = SampleMode::GEOMETRIC,
+             size_t chunk_bases = DEFAULT_CHUNK_BASES,
+             SnpOverlay* snps = nullptr,
+             size_t first_chrom = 0);
+
+/*
+    INDEL and SNP in one pass over the LS chains, the same models as gen_INDEL and gen_SNP
+    the gap to the next event is drawn from the combined rate indel_rate + snp_rate, the event is a SNP with
+    probability snp_rate / (indel_rate + snp_rate) and an insertion or a deletion (50-50) otherwise,
+    so every visible base is visited once instead of once per pass
+
+    events fall on the mutated chromosome, bases inserted by earlier passes included (not the ones this pass
+    inserts, the walk steps over them like gen_INDEL's), and records come out in mutated chromosome order, in reference orientation like gen_INDEL's (a SNP on a
+    reversed LS is recorded with the forward strand REF and ALT), an event on bases of an inserted Sequence
+    is recorded at the last reference base before it with INFO ";INSERTED=<k>" like gen_INDEL's
+    a SNP is written into the Sequence (or into snps if given) once every chunk is done, so like gen_SNP
+    it shows up in every LS pointing at that base
+
+    chunks and records as gen_INDEL, sequences must already be materialized
+    linkedseqs[i] is chromosome first_chrom + i, same as gen_INDEL
+*/
+void gen_SNP_INDEL(std::vector<LinkedSequence*>& linkedseqs,
+                   RecordSink& mut_record,
+                   const std::vector<double>& ins_prob,
+                   const std::vector<double>& del_prob,
+                   const std::vector<double>& ins_base_prob,
+                   double indel_rate,
+                   const std::vector<std::vector<double>>& snp_prob,
+                   double snp_rate,
+                   uint64_t seed,
+                   ThreadPool& workers,
+                   SampleMode mode = SampleMode::GEOMETRIC,
+                   size_t chunk_bases = DEFAULT_CHUNK_BASES,
+                   SnpOverlay* snps = nullptr,
+                   size_t first_chrom = 0);
+
+/*
+    Sampler for the number of bases skipped before the next mutated base
+    each base mutates independently with prob rate, so the gap is geometric
+    in BERNOULLI mode the gap is built by flipping one coin per base instead
+    a rate <= 0 never mutates, next() returns NO_MUTATION
+
+    GEOMETRIC gaps are made BLOCK at a time by inversion, floor(log(u) / log(1 - rate)),
+    from one rng_fill_uniform call, so a block costs one pass over the generator and one over log()
+*/
+class GapSampler {
+    public:
+        static constexpr size_t NO_MUTATION = static_cast<size_t>(-1);
+
+        GapSampler(double rate, SampleMode mode);
+
+        size_t next(MutationRNG& gen);
+
+    private:
+        static constexpr size_t BLOCK = 64;
+
+        // refill gaps_ with the next BLOCK geometric gaps
+        void refill(MutationRNG& gen);
+
+        double rate_;
+        SampleMode mode_;
+        std::bernoulli_distribution bd_;
+        // 1 / log(1 - rate)
+        double inv_log_q_;
+        size_t gaps_[BLOCK];
+        size_t used_;
+};
 
 /*
     generate length n nuleotide string and store it on the stack
-    probability of ATCG are passed in via base_prob, in that order on the vector
-    this method shouldn't modify the vector
-    
+    bases is an AliasTable over the weights of ATCG, in that order
+
     returns a pointer to that string
     caller responsible of the data
 */
-std::string* gen_n_nucleotides(std::vector<double>& base_prob, size_t n, std::mt19937& gen);
+std::string* gen_n_nucleotides(const AliasTable& bases, size_t n, MutationRNG& gen);
+
+/*
+    same as above but overwrite out with the n bases, drawn in one batch
+    out keeps its capacity, so a buffer reused across calls stops allocating
+*/
+void gen_n_nucleotides(const AliasTable& bases, size_t n, MutationRNG& gen, std::string& out);
+
+/*
+    generate length n nucleotide Sequence for an insertion, same as gen_n_nucleotides
+    but packed = true generates it directly in 2 bit packed storage
+    caller responsible of the Sequence
+*/
+Sequence* gen_inserted_seq(const AliasTable& bases, size_t n, MutationRNG& gen, bool packed);
+
+/*
+    return all bases of seq as a string, whatever its storage
+*/
+std::string deep_copy_string(Sequence* seq);
 
 /*
-    Copy length number of characters starting from pos in ls, move to .next ls if needed
-    return the resulting string
-    used to capture deleted segment (could potentially do more)
+    Copy length number of visible characters starting from pos in ls, move to .next ls if needed
+    return the resulting string, reversed LS give their reverse complement
+    string wrapper of LinkedSequence::copy_range, which copies into a caller buffer instead
 */
 std::string deep_copy_string(const LinkedSequence* ls, size_t pos, size_t length);
 